@@ -249,6 +249,13 @@ bool Imu::read() {
   accY = double(ay) * accScale;
   accZ = double(az) * accScale;
 
+  /////////////////////////////////////////////////////////////////////////////
+  // Read temperature
+
+  /* 16 bit temperature raw data, 333.87 per deg C, 0 at 21 deg C */
+  int16_t t = Buf[6] << 8 | Buf[7];
+  temperature = double(t) / 333.87 + 21.0;
+
   /////////////////////////////////////////////////////////////////////////////
   // Read gyroscope
 
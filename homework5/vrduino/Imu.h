@@ -21,6 +21,9 @@ public:
   double accX, accY, accZ;
   double magX, magY, magZ;
 
+  // die temperature in deg C
+  double temperature;
+
   /* initialize imu */
   void init();
 
@@ -1,11 +1,14 @@
 #include "OrientationTracker.h"
 
-OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateImuIn) :
+OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateImuIn,
+  int estimatorsIn) :
 
   imu(),
   gyr{0,0,0},
   acc{0,0,0},
   gyrBias{0,0,0},
+  gyrBiasModel(),
+  learnGyrBias(false),
   gyrVariance{0,0,0},
   accBias{0,0,0},
   accVariance{0,0,0},
@@ -14,12 +17,16 @@ OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateIm
   deltaT(0.0),
   simulateImu(simulateImuIn),
   simulateImuCounter(0),
+  estimators(estimatorsIn & ORIENTATION_ESTIMATORS),
+  currentEstimators(0),
   flatlandRollGyr(0),
   flatlandRollAcc(0),
   flatlandRollComp(0),
   quaternionGyr{1,0,0,0},
   eulerAcc{0,0,0},
-  quaternionComp{1,0,0,0}
+  quaternionComp{1,0,0,0},
+  filter(imuFilterAlphaIn),
+  orientationCycles()
 
   {
 
@@ -27,6 +34,7 @@ OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateIm
 
 void OrientationTracker::initImu() {
   imu.init();
+  enableCycleCounter();
 }
 
 
@@ -56,8 +64,11 @@ void OrientationTracker::measureImuBiasVariance() {
 
   // Take the measurements
 
+  double temperatureSum = 0;
+
   for (int i = 0; i < N_MEASUREMENTS; i++) {
     while (not imu.read()) {}
+    temperatureSum += imu.temperature;
     gyrX_samples[i] = imu.gyrX;
     gyrY_samples[i] = imu.gyrY;
     gyrZ_samples[i] = imu.gyrZ;
@@ -108,13 +119,18 @@ void OrientationTracker::measureImuBiasVariance() {
   accVariance[1] = accVarianceY_numerator / (N_MEASUREMENTS - 1);
   accVariance[2] = accVarianceZ_numerator / (N_MEASUREMENTS - 1);
 
+  // the bias is the one at the mean temperature of the measurements
+  gyrBiasModel.setVariance(gyrVariance);
+  gyrBiasModel.setBias(gyrBias, temperatureSum / N_MEASUREMENTS, N_MEASUREMENTS);
+
 }
 
-void OrientationTracker::setImuBias(double bias[3]) {
+void OrientationTracker::setImuBias(double bias[3], double temperature) {
 
   for (int i = 0; i < 3; i++) {
     gyrBias[i] = bias[i];
   }
+  gyrBiasModel.setBias(gyrBias, temperature);
 
 }
 
@@ -128,6 +144,8 @@ void OrientationTracker::resetOrientation() {
   eulerAcc[1] = 0;
   eulerAcc[2] = 0;
   quaternionComp = Quaternion();
+  filter.reset();
+  currentEstimators = 0;
 
 }
 
@@ -151,7 +169,9 @@ bool OrientationTracker::processImu() {
   }
 
   //run orientation tracking algorithms
+  uint32_t startCycles = getCycleCount();
   updateOrientation();
+  orientationCycles.add(getCycleCount() - startCycles);
 
   return true;
 
@@ -189,10 +209,11 @@ bool OrientationTracker::updateImuVariables() {
 
   //call micros() to get current time in microseconds
   //update:
-  //previousTimeImu (in seconds)
+  //previousTimeImu (in microseconds)
   //deltaT (in seconds)
-  double currentTimeImu = ((double) micros()) / 1000000;
-  deltaT = currentTimeImu - previousTimeImu;
+  //the unsigned difference stays correct when micros() wraps around
+  unsigned long currentTimeImu = micros();
+  deltaT = (currentTimeImu - previousTimeImu) / 1000000.0;
   previousTimeImu = currentTimeImu;
 
   //read imu.gyrX, imu.accX ...
@@ -200,16 +221,22 @@ bool OrientationTracker::updateImuVariables() {
   //gyr[0], ...
   //acc[0], ...
 
-  // Export the gyroscope measurements (adjusting for bias)
-  gyr[0] = imu.gyrX - gyrBias[0];
-  gyr[1] = imu.gyrY - gyrBias[1];
-  gyr[2] = imu.gyrZ - gyrBias[2];
-
   // Export the accelerometer measurements
   acc[0] = imu.accX;
   acc[1] = imu.accY;
   acc[2] = imu.accZ;
 
+  // Export the gyroscope measurements (adjusting for the bias at the
+  // current temperature)
+  double gyrRaw[3] = {imu.gyrX, imu.gyrY, imu.gyrZ};
+  if (learnGyrBias) {
+    gyrBiasModel.addSample(gyrRaw, acc, imu.temperature);
+  }
+  gyrBiasModel.computeBias(imu.temperature, gyrBias);
+  gyr[0] = gyrRaw[0] - gyrBias[0];
+  gyr[1] = gyrRaw[1] - gyrBias[1];
+  gyr[2] = gyrRaw[2] - gyrBias[2];
+
   return true;
 
 }
@@ -220,26 +247,46 @@ bool OrientationTracker::updateImuVariables() {
  */
 void OrientationTracker::updateOrientation() {
 
-  //call functions in OrientationMath.cpp.
-  //use only class variables as arguments to functions.
+  //ORIENTATION_ESTIMATORS is a constant, estimators that are not compiled
+  //in are removed as dead code
+  int enabled = estimators & ORIENTATION_ESTIMATORS;
 
-  //update:
-  //flatlandRollGyr
-  //flatlandRollAcc
-  //flatlandRollComp
-  //quaternionGyr
-  //eulerAcc
-  //quaternionComp
+  //flatland roll estimate
+  if (enabled & EST_FLATLAND_GYR) {
+    flatlandRollGyr = computeFlatlandRollGyr(
+      flatlandRollGyr, gyr, deltaT);
+  }
+
+  //the flatland comp filter corrects with the acc roll
+  if (enabled & EST_FLATLAND_COMP) {
+    enabled |= EST_FLATLAND_ACC;
+  }
+
+  if (enabled & EST_FLATLAND_ACC) {
+    flatlandRollAcc = computeFlatlandRollAcc(acc);
+  }
+
+  if (enabled & EST_FLATLAND_COMP) {
+    flatlandRollComp = computeFlatlandRollComp(
+      flatlandRollComp, gyr, flatlandRollAcc, deltaT, imuFilterAlpha);
+  }
 
-  flatlandRollGyr = computeFlatlandRollGyr(flatlandRollGyr, gyr, deltaT);
-  flatlandRollAcc = computeFlatlandRollAcc(acc);
-  flatlandRollComp = computeFlatlandRollComp(flatlandRollComp, gyr, flatlandRollAcc, deltaT, imuFilterAlpha);
+  //updates quaternion estimate with only gyro values
+  if (enabled & EST_QUATERNION_GYR) {
+    updateQuaternionGyr(quaternionGyr, gyr, deltaT);
+  }
 
-  updateQuaternionGyr(quaternionGyr, gyr, deltaT);
+  //performs euler complementary filtering with gyro and acc values
+  if (enabled & EST_EULER_ACC) {
+    eulerAcc[0] = computeAccPitch(acc);
+    eulerAcc[2] = computeAccRoll(acc);
+  }
 
-  eulerAcc[0] = computeAccPitch(acc);
-  eulerAcc[2] = computeAccRoll(acc);
+  //performs quaternion filtering with gyro and acc values
+  if (enabled & EST_QUATERNION_COMP) {
+    filter.update(quaternionComp, gyr, acc, deltaT);
+  }
 
-  updateQuaternionComp(quaternionComp, gyr, acc, deltaT, imuFilterAlpha);
+  currentEstimators = enabled;
 
 }
@@ -6,7 +6,8 @@
  * - performs complementary filtering to estimate orientation
  * in either  euler angles or quaternion
  * - calls functions from Quaternion for quaternion math
- * - calls functions from OrientationMath for complementary filtering
+ * - calls functions from OrientationMath for complementary filtering,
+ *   through the filter ORIENTATION_FILTER, see OrientationFilter.h
  *
  * The complementary filter alpha value is between [0,1].
  * If 1, ignore angle correction from acc. If 0, use full correction
@@ -18,14 +19,61 @@
  * - gyro and acc values (after preprocessing)
  * - gyro bias and variance
  *
+ * The gyro bias follows the imu temperature with a linear model, which can
+ * be learned while the imu is stationary, see GyroBiasModel.
+ *
+ * Each estimator is only updated if it is enabled, see setEstimators().
+ * The estimators that are not enabled keep their last value, use
+ * isCurrent() to check if a value belongs to the current sample.
+ *
  */
 
 #pragma once
 #include "Imu.h"
 #include "Quaternion.h"
 #include "OrientationMath.h"
+#include "OrientationFilter.h"
+#include "GyroBiasModel.h"
+#include "CycleCounter.h"
 #include "simulatedImuData.h"
 
+/**
+ * orientation estimators of OrientationTracker, as bits of a mask
+ */
+enum OrientationEstimator {
+
+  EST_FLATLAND_GYR    = 1 << 0, // flatlandRollGyr
+  EST_FLATLAND_ACC    = 1 << 1, // flatlandRollAcc
+  EST_FLATLAND_COMP   = 1 << 2, // flatlandRollComp, also updates flatlandRollAcc
+  EST_QUATERNION_GYR  = 1 << 3, // quaternionGyr
+  EST_EULER_ACC       = 1 << 4, // eulerAcc
+  EST_QUATERNION_COMP = 1 << 5  // quaternionComp
+
+};
+
+/** mask of all estimators */
+#define EST_ALL 0x3F
+
+/**
+ * mask of the estimators that are compiled in. the others are never
+ * updated, whatever setEstimators() enables. e.g. compile only the comp
+ * filter with the compiler flag -DORIENTATION_ESTIMATORS=EST_QUATERNION_COMP,
+ * or by changing the default below. it must be the same in all files, a
+ * #define in the sketch does not apply to OrientationTracker.cpp.
+ */
+#ifndef ORIENTATION_ESTIMATORS
+#define ORIENTATION_ESTIMATORS EST_ALL
+#endif
+
+/**
+ * filter of quaternionComp, a class of OrientationFilter.h, e.g.
+ * -DORIENTATION_FILTER=GyroFilter. like ORIENTATION_ESTIMATORS, it must be
+ * the same in all files
+ */
+#ifndef ORIENTATION_FILTER
+#define ORIENTATION_FILTER ComplementaryFilter
+#endif
+
 class OrientationTracker {
 
   public:
@@ -35,8 +83,10 @@ class OrientationTracker {
      * @param [in] imuFilterAlpha - alpha value [0,1] for complementary filter
      *   1: ignore tilt correction from acc. 0: use full tilt correction from acc
      * @param [in] simulateImu - if true, get imu values from external file
+     * @param [in] estimators - mask of the enabled estimators, see setEstimators()
      */
-    OrientationTracker(double imuFilterAlpha, bool simulateImu) ;
+    OrientationTracker(double imuFilterAlpha, bool simulateImu,
+      int estimators = EST_ALL) ;
 
 
     /**
@@ -48,7 +98,7 @@ class OrientationTracker {
     bool processImu();
 
 
-    /** initializes Imu */
+    /** initializes Imu, and the cycle counter */
     void initImu();
 
 
@@ -72,8 +122,36 @@ class OrientationTracker {
      * sets the Imu bias
      * @param [in] bias - copy the bias values in this array into
      *  this class' gyrBias variable
+     * @param [in] temperature - imu temperature in deg C of the bias,
+     *  NAN: the temperature of the next sample
+     */
+    void setImuBias(double bias[3], double temperature = NAN);
+
+
+    /**
+     * sets the change of the gyro bias per deg C of the imu temperature,
+     * e.g. learned before, see getGyrBiasModel()
+     */
+    void setImuBiasSlope(double slope[3]) { gyrBiasModel.setSlope(slope); };
+
+
+    /**
+     * @param [in] learn - if true, the model of the gyro bias is updated
+     *  while the imu is stationary
+     */
+    void setGyrBiasLearning(bool learn) { learnGyrBias = learn; };
+
+
+    /**
+     * @returns model of the gyro bias over the imu temperature
+     */
+    const GyroBiasModel& getGyrBiasModel() const { return gyrBiasModel; };
+
+
+    /**
+     * @returns imu temperature of the current sample, in deg C
      */
-    void setImuBias(double bias[3]);
+    double getImuTemperature() const { return imu.temperature; };
 
 
     /**
@@ -82,6 +160,36 @@ class OrientationTracker {
     void resetOrientation();
 
 
+    /**
+     * enables the estimators updated with each imu sample. an estimator
+     * that is enabled again continues from its last value, call
+     * resetOrientation() to start from 0.
+     * @param [in] mask - bitwise or of OrientationEstimator values
+     */
+    void setEstimators(int mask) { estimators = mask & ORIENTATION_ESTIMATORS; };
+
+
+    /**
+     * @returns mask of the enabled estimators
+     */
+    int getEstimators() const { return estimators; };
+
+
+    /**
+     * @returns true if the estimator was updated with the current imu
+     * sample, false if its value is stale
+     */
+    bool isCurrent(OrientationEstimator estimator) const {
+      return (currentEstimators & estimator) != 0;
+    };
+
+
+    /**
+     * @returns the filter of quaternionComp, to change its parameters
+     */
+    ORIENTATION_FILTER& getFilter() { return filter; };
+
+
     /**
      * @returns flatland roll estimate from gyro readings
      */
@@ -161,6 +269,18 @@ class OrientationTracker {
     const double* getAccVariance() const { return accVariance; };
 
 
+    /**
+     * @returns CPU cycles spent in updateOrientation() per imu sample
+     */
+    const CycleStats& getOrientationCycles() const { return orientationCycles; };
+
+
+    /**
+     * starts a new measurement window of the cycle statistics
+     */
+    void resetCycleStats() { orientationCycles.reset(); };
+
+
   protected:
 
     /**
@@ -169,7 +289,7 @@ class OrientationTracker {
      * steps:
      * - call imu.read() to sample imu, then read imu.gyrX/Y/Z, imu.accX/Y/Z.
      *   units are in deg/s for gyro, m/s^2 for acc
-     * - subtract bias for the gyro
+     * - subtract bias for the gyro, at the imu temperature
      * - store the values in the arrays: gyr, acc.
      *   These are 3 element arrays, with elements the following order [x,y,z]
      *   i.e. gyr[0] corresponds to the rotational velocity about x-axis
@@ -191,8 +311,8 @@ class OrientationTracker {
 
 
     /**
-     * calls the orientation tracking functions and
-     * updates the following orientation variables:
+     * calls the orientation tracking functions of the enabled estimators
+     * and updates the following orientation variables:
      * - flatlandRollGyr
      * - flatlandRollAcc
      * - flatlandRollComp
@@ -237,11 +357,24 @@ class OrientationTracker {
 
 
     /**
-     * gyro bias values. order is: (wx,wy,wz)
+     * gyro bias values at the temperature of the current sample.
+     * order is: (wx,wy,wz)
      */
     double gyrBias[3];
 
 
+    /**
+     * gyro bias over the imu temperature
+     */
+    GyroBiasModel gyrBiasModel;
+
+
+    /**
+     * if true, gyrBiasModel is learned while the imu is stationary
+     */
+    bool learnGyrBias;
+
+
     /**
      * gyro variance values. order is: (wx,wy,wz)
      */
@@ -261,9 +394,10 @@ class OrientationTracker {
 
 
     /**
-     * the previous time in s the imu was polled
+     * the previous time in us the imu was polled. micros() wraps around
+     * after ~71 minutes, use unsigned differences only
      */
-    double previousTimeImu;
+    unsigned long previousTimeImu;
 
 
     /**
@@ -293,6 +427,18 @@ class OrientationTracker {
     int simulateImuCounter;
 
 
+    /**
+     * mask of the enabled estimators
+     */
+    int estimators;
+
+
+    /**
+     * mask of the estimators updated with the current imu sample
+     */
+    int currentEstimators;
+
+
     /**
      * estimate of flatland roll from gyro values
      */
@@ -330,4 +476,16 @@ class OrientationTracker {
     Quaternion quaternionComp;
 
 
+    /**
+     * filter that updates quaternionComp
+     */
+    ORIENTATION_FILTER filter;
+
+
+    /**
+     * CPU cycles spent in updateOrientation()
+     */
+    CycleStats orientationCycles;
+
+
 };
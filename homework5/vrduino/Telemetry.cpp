@@ -0,0 +1,473 @@
+#include "Telemetry.h"
+
+/** tags of the text messages, indexed by TelemetryType */
+static const char* const tags[] = {
+  "", "BS", "NP", "TL", "PS", "QH", "PD", "VP", "LS", "CY", "TI", "QC",
+  "QG", "EA", "FLAT", "GYR:", "ACC:", "nReads/sec:", "GYR_BIAS:",
+  "GYR_VAR:", "ACC_BIAS:", "ACC_VAR:", "LR", "nLoops/sec:", "CF", "CN",
+  "GYR_TEMP:"
+};
+
+void Telemetry::begin(TelemetryType type_, uint64_t timestamp_) {
+
+  type = type_;
+  timestamp = timestamp_;
+  skip = !isSubscribed(type);
+
+  if (skip) {
+    return;
+  }
+
+  if (!binary) {
+    Serial.print(tags[type]);
+    return;
+  }
+
+  frame[0] = TELEMETRY_VERSION;
+  frame[1] = (uint8_t)type | (quantized ? TM_QUANTIZED : 0);
+  length = 2;
+  put32((uint32_t)timestamp);
+  put32((uint32_t)(timestamp >> 32));
+
+}
+
+void Telemetry::addFloat(double value, int decimals) {
+
+  if (skip) {
+    return;
+  }
+
+  if (!binary) {
+    Serial.printf(" %.*f", decimals, value);
+    return;
+  }
+
+  float f = (float)value;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  put32(bits);
+
+}
+
+void Telemetry::addInt(int32_t value) {
+
+  if (skip) {
+    return;
+  }
+
+  if (!binary) {
+    Serial.printf(" %ld", (long)value);
+    return;
+  }
+
+  put32((uint32_t)value);
+
+}
+
+void Telemetry::addUint(uint32_t value) {
+
+  if (skip) {
+    return;
+  }
+
+  if (!binary) {
+    Serial.printf(" %lu", (unsigned long)value);
+    return;
+  }
+
+  put32(value);
+
+}
+
+void Telemetry::addQuaternion(const Quaternion& q) {
+
+  if (skip) {
+    return;
+  }
+
+  if (!binary || !quantized) {
+    for (int i = 0; i < 4; i++) {
+      addFloat(q.q[i]);
+    }
+    return;
+  }
+
+  put32(packQuaternion(q));
+
+}
+
+void Telemetry::addPosition(const double position[3]) {
+
+  // skipped positions do not advance the keyframes
+  if (skip) {
+    return;
+  }
+
+  if (!binary || !quantized) {
+    for (int i = 0; i < 3; i++) {
+      addFloat(position[i]);
+    }
+    return;
+  }
+
+  uint8_t encoded[13];
+  put(encoded, positionCodec.encode(position, encoded));
+
+}
+
+void Telemetry::end() {
+
+  if (skip) {
+    skip = false;
+    return;
+  }
+
+  if (!binary) {
+    if (type == TM_TI || type == TM_TL) {
+      Serial.printf(" %.6f", timestamp / 1000000.0);
+    }
+    Serial.println();
+    nFrames++;
+    return;
+  }
+
+  send();
+
+}
+
+void Telemetry::text(const char* message) {
+
+  if (!binary) {
+    Serial.println(message);
+    nFrames++;
+    return;
+  }
+
+  begin(TM_TEXT, micros());
+  // leave room for the CRC
+  while (*message && length < TELEMETRY_MAX_FRAME - 2) {
+    frame[length++] = (uint8_t)*message++;
+  }
+  send();
+
+}
+
+void Telemetry::put32(uint32_t value) {
+
+  uint8_t bytes[4] = {
+    (uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF),
+    (uint8_t)((value >> 16) & 0xFF), (uint8_t)((value >> 24) & 0xFF)
+  };
+  put(bytes, 4);
+
+}
+
+void Telemetry::put(const uint8_t* data, int n) {
+
+  // fields that do not fit are dropped, the frame stays valid
+  if (length + n > TELEMETRY_MAX_FRAME - 2) {
+    return;
+  }
+
+  memcpy(frame + length, data, n);
+  length += n;
+
+}
+
+void Telemetry::send() {
+
+  uint16_t crc = crc16(frame, length);
+  frame[length++] = crc & 0xFF;
+  frame[length++] = (crc >> 8) & 0xFF;
+
+  uint8_t encoded[TELEMETRY_MAX_FRAME + TELEMETRY_MAX_FRAME / 254 + 2];
+  int n = cobsEncode(frame, length, encoded);
+  encoded[n++] = 0;
+
+  Serial.write(encoded, n);
+  length = 0;
+  nFrames++;
+
+}
+
+bool Telemetry::readCommand(Command& command) {
+
+  while (Serial.available()) {
+
+    int byte = Serial.read();
+
+    if (!binary) {
+      command.type = CMD_KEY;
+      command.payload[0] = (uint8_t)byte;
+      command.length = 1;
+      nCommands++;
+      return true;
+    }
+
+    if (byte != 0) {
+      if (rxLength < (int)sizeof(rx)) {
+        rx[rxLength++] = (uint8_t)byte;
+      } else {
+        rxOverflow = true;
+      }
+      continue;
+    }
+
+    //end of a frame, empty frames of repeated delimiters are skipped
+    if (rxLength == 0 && !rxOverflow) {
+      continue;
+    }
+    bool valid = !rxOverflow && decodeCommand(command);
+    rxLength = 0;
+    rxOverflow = false;
+    if (valid) {
+      nCommands++;
+      return true;
+    }
+    nCommandErrors++;
+
+  }
+
+  return false;
+
+}
+
+bool Telemetry::decodeCommand(Command& command) {
+
+  uint8_t decoded[sizeof(rx)];
+  int n = cobsDecode(rx, rxLength, decoded);
+
+  if (n < 4 || n - 4 > TELEMETRY_MAX_COMMAND || decoded[0] != TELEMETRY_VERSION) {
+    return false;
+  }
+
+  uint16_t crc = decoded[n - 2] | (decoded[n - 1] << 8);
+  if (crc16(decoded, n - 2) != crc) {
+    return false;
+  }
+
+  //a key command without the key is invalid
+  if (decoded[1] == CMD_KEY && n - 4 < 1) {
+    return false;
+  }
+
+  command.type = (CommandType)decoded[1];
+  command.length = n - 4;
+  memcpy(command.payload, decoded + 2, command.length);
+  return true;
+
+}
+
+uint32_t Command::getUint(int offset) const {
+
+  if (offset + 4 > length) {
+    return 0;
+  }
+  return (uint32_t)payload[offset] | ((uint32_t)payload[offset + 1] << 8) |
+    ((uint32_t)payload[offset + 2] << 16) | ((uint32_t)payload[offset + 3] << 24);
+
+}
+
+float Command::getFloat(int offset) const {
+
+  uint32_t bits = getUint(offset);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+
+}
+
+uint16_t crc16(const uint8_t* data, int length) {
+
+  uint16_t crc = 0xFFFF;
+  for (int i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+
+}
+
+int cobsEncode(const uint8_t* data, int length, uint8_t* out) {
+
+  // out[codeIndex] is the distance to the next 0 of the data, or 0xFF
+  // if a block of 254 bytes without 0 ends
+  int codeIndex = 0;
+  int n = 1;
+  uint8_t code = 1;
+
+  for (int i = 0; i < length; i++) {
+
+    if (data[i] == 0) {
+      out[codeIndex] = code;
+      codeIndex = n++;
+      code = 1;
+    } else {
+      out[n++] = data[i];
+      code++;
+      if (code == 0xFF) {
+        out[codeIndex] = code;
+        codeIndex = n++;
+        code = 1;
+      }
+    }
+
+  }
+
+  out[codeIndex] = code;
+  return n;
+
+}
+
+int cobsDecode(const uint8_t* data, int length, uint8_t* out) {
+
+  int n = 0;
+  int i = 0;
+
+  while (i < length) {
+
+    uint8_t code = data[i++];
+    if (code == 0 || i + code - 1 > length) {
+      return -1;
+    }
+
+    for (int j = 1; j < code; j++) {
+      out[n++] = data[i++];
+    }
+
+    //a block shorter than 254 bytes ends with a 0, except the last one
+    if (code < 0xFF && i < length) {
+      out[n++] = 0;
+    }
+
+  }
+
+  return n;
+
+}
+
+/** range of the three smallest components of a unit quaternion */
+static const double QUATERNION_RANGE = 0.70710678118654752;
+
+/** largest value of a 10 bit component */
+static const double QUATERNION_STEPS = 1023.0;
+
+uint32_t packQuaternion(const Quaternion& q) {
+
+  int largest = 0;
+  for (int i = 1; i < 4; i++) {
+    if (fabs(q.q[i]) > fabs(q.q[largest])) {
+      largest = i;
+    }
+  }
+  double sign = (q.q[largest] < 0) ? -1.0 : 1.0;
+
+  uint32_t packed = (uint32_t)largest << 30;
+  int shift = 20;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) {
+      continue;
+    }
+    double c = constrain(sign * q.q[i], -QUATERNION_RANGE, QUATERNION_RANGE);
+    uint32_t v = (uint32_t)((c + QUATERNION_RANGE) / (2 * QUATERNION_RANGE) * QUATERNION_STEPS + 0.5);
+    packed |= v << shift;
+    shift -= 10;
+  }
+  return packed;
+
+}
+
+Quaternion unpackQuaternion(uint32_t packed) {
+
+  Quaternion q;
+  int largest = packed >> 30;
+  int shift = 20;
+  double sum = 0;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) {
+      continue;
+    }
+    uint32_t v = (packed >> shift) & 0x3FF;
+    q.q[i] = v / QUATERNION_STEPS * 2 * QUATERNION_RANGE - QUATERNION_RANGE;
+    sum += q.q[i] * q.q[i];
+    shift -= 10;
+  }
+  q.q[largest] = sqrt(max(0.0, 1.0 - sum));
+  return q;
+
+}
+
+/** resolution of the position deltas in mm */
+static const double POSITION_DELTA_STEP = 0.1;
+
+PositionCodec::PositionCodec(int keyframeInterval) :
+  keyframeInterval(keyframeInterval),
+  keyframe{0, 0, 0},
+  keyframeId(-1),
+  count(0)
+  {
+
+}
+
+int PositionCodec::encode(const double position[3], uint8_t* out) {
+
+  int16_t delta[3];
+  bool fits = true;
+  for (int i = 0; i < 3; i++) {
+    double d = (position[i] - keyframe[i]) / POSITION_DELTA_STEP;
+    if (fabs(d) > 32767) {
+      fits = false;
+      break;
+    }
+    delta[i] = (int16_t)lround(d);
+  }
+
+  if (keyframeId < 0 || count >= keyframeInterval || !fits) {
+
+    keyframeId = (keyframeId + 1) & 0x7F;
+    count = 0;
+    out[0] = 0x80 | keyframeId;
+    for (int i = 0; i < 3; i++) {
+      keyframe[i] = (float)position[i];
+      memcpy(out + 1 + 4 * i, &keyframe[i], 4);
+    }
+    return 13;
+
+  }
+
+  count++;
+  out[0] = keyframeId;
+  for (int i = 0; i < 3; i++) {
+    out[1 + 2 * i] = (uint16_t)delta[i] & 0xFF;
+    out[2 + 2 * i] = ((uint16_t)delta[i] >> 8) & 0xFF;
+  }
+  return 7;
+
+}
+
+int PositionCodec::decode(const uint8_t* in, int length, double position[3]) {
+
+  if (length >= 13 && (in[0] & 0x80)) {
+
+    keyframeId = in[0] & 0x7F;
+    for (int i = 0; i < 3; i++) {
+      memcpy(&keyframe[i], in + 1 + 4 * i, 4);
+      position[i] = keyframe[i];
+    }
+    return 13;
+
+  }
+
+  if (length < 7 || (in[0] & 0x80) || in[0] != keyframeId) {
+    return 0;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    int16_t delta = (int16_t)(in[1 + 2 * i] | (in[2 + 2 * i] << 8));
+    position[i] = keyframe[i] + delta * POSITION_DELTA_STEP;
+  }
+  return 7;
+
+}
@@ -0,0 +1,363 @@
+/**
+ * @file
+ * messages from the vrduino to the host, as binary frames or as text lines.
+ *
+ * a binary frame is, before encoding (multi-byte fields little endian):
+ *   byte 0       protocol version, TELEMETRY_VERSION
+ *   byte 1       message type, see TelemetryType
+ *   bytes 2-9    timestamp in us, uint64, so it does not wrap around
+ *   bytes 10-    payload: float32, int32 and uint32 fields, in the
+ *                order of the text message of the same type
+ *   last 2 bytes CRC-16/CCITT-FALSE of all bytes before
+ * the frame is COBS encoded, so it has no 0 bytes, and terminated with a 0.
+ * the host can start decoding at any 0 byte, e.g. after lost bytes.
+ *
+ * if quantization is enabled, bit 7 of the type (TM_QUANTIZED) is set, and
+ * quaternions and positions are packed, see packQuaternion() and
+ * PositionCodec. other fields are unchanged.
+ *
+ * in text mode the same messages are printed as lines "TAG v0 v1 ...\n",
+ * without the timestamp, which is the format of the previous sketches.
+ * the host subscribes to message types, see readCommand(). messages of
+ * other types are not sent, and the sketch can skip computing them:
+ *   if (telemetry.isSubscribed(TM_QC)) {
+ *     telemetry.begin(TM_QC, timestamp);
+ *     telemetry.addFloat(q.q[0]); ...
+ *     telemetry.end();
+ *   }
+ *
+ * commands from the host are framed like the messages, without timestamp:
+ *   byte 0       protocol version, TELEMETRY_VERSION
+ *   byte 1       command type, see CommandType
+ *   bytes 2-     payload
+ *   last 2 bytes CRC-16/CCITT-FALSE of all bytes before
+ * in text mode, each character received is a CMD_KEY command.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "Quaternion.h"
+
+/** version of the binary frame layout, increased when it changes */
+#define TELEMETRY_VERSION 2
+
+/** maximum size of a frame before encoding, in bytes */
+#define TELEMETRY_MAX_FRAME 96
+
+/** maximum size of a command frame before encoding, in bytes */
+#define TELEMETRY_MAX_COMMAND 24
+
+/** maximum number of output streams with a rate, see CMD_SET_RATE */
+#define TELEMETRY_MAX_STREAMS 4
+
+/**
+ * message types. the layouts of the payloads are listed in server.js,
+ * which converts the frames to the text messages for the browser.
+ */
+enum TelemetryType {
+
+  TM_TEXT     = 0,  // free text, payload are the characters
+  TM_BS       = 1,  // base station pitch, roll (float), mode (int)
+  TM_NP       = 2,  // number of sweep pulses of 8 axes (uint)
+  TM_TL       = 3,  // time of the lighthouse pose, only the timestamp
+  TM_PS       = 4,  // position x, y, z (float)
+  TM_QH       = 5,  // quaternion of the pose w, x, y, z (float)
+  TM_PD       = 6,  // 2d positions of 4 photodiodes (float)
+  TM_VP       = 7,  // strict and valid pose rate (int)
+  TM_LS       = 8,  // sync locked (int), resyncs, missed, rejected (uint), rotor period (float)
+  TM_CY       = 9,  // cycles per sample of the filters and the output (uint)
+  TM_TI       = 10, // time of the imu sample, only the timestamp
+  TM_QC       = 11, // quaternion of the comp filter w, x, y, z (float)
+  TM_QG       = 12, // quaternion of the gyro w, x, y, z (float)
+  TM_EA       = 13, // euler angles of the acc (float)
+  TM_FLAT     = 14, // flatland roll gyro, acc, comp (float)
+  TM_GYR      = 15, // gyro values (float)
+  TM_ACC      = 16, // acc values (float)
+  TM_NREADS   = 17, // imu reads per second (uint)
+  TM_GYR_BIAS = 18, // gyro bias (float)
+  TM_GYR_VAR  = 19, // gyro variance (float)
+  TM_ACC_BIAS = 20, // acc bias (float)
+  TM_ACC_VAR  = 21, // acc variance (float)
+  TM_LR       = 22, // loop iterations, imu samples, lighthouse frames per second (uint)
+  TM_NLOOPS   = 23, // loop iterations per second (uint)
+  TM_CONFIG   = 24, // subscribed types (uint), TELEMETRY_MAX_STREAMS stream rates (float)
+  TM_COUNTERS = 25, // loop iterations, imu samples, lighthouse frames, frames sent,
+                    // commands received, invalid commands (uint), since start
+  TM_GYR_TEMP = 26  // imu temperature, temperature of the gyro bias (float), gyro
+                    // bias at that temperature, gyro bias slope per deg C (float),
+                    // stationary periods learned (uint)
+
+};
+
+/** subscription mask of all message types */
+#define TM_ALL 0xFFFFFFFFUL
+
+/** @returns subscription mask of a message type */
+inline uint32_t telemetryMask(TelemetryType type) { return 1UL << type; }
+
+/** commands from the host */
+enum CommandType {
+
+  CMD_KEY          = 0, // character command of the text protocol (uint8)
+  CMD_SUBSCRIBE    = 1, // mask of the message types to send (uint32)
+  CMD_SET_RATE     = 2, // stream (uint8), rate in Hz, 0: every update (float32)
+  CMD_GET_CONFIG   = 3, // replies TM_CONFIG
+  CMD_GET_COUNTERS = 4  // replies TM_COUNTERS
+
+};
+
+/** a command received from the host */
+struct Command {
+
+  CommandType type;
+
+  /** payload, little endian */
+  uint8_t payload[TELEMETRY_MAX_COMMAND];
+
+  /** number of bytes in payload */
+  int length;
+
+  /** @returns the uint32 at offset in the payload, 0 if it is too short */
+  uint32_t getUint(int offset) const;
+
+  /** @returns the float32 at offset in the payload, 0 if it is too short */
+  float getFloat(int offset) const;
+
+};
+
+/** flag in the type byte of frames with packed quaternions and positions */
+#define TM_QUANTIZED 0x80
+
+/**
+ * packs a unit quaternion into 32 bits ("smallest three"): bits 30-31 hold
+ * the index of the largest component, which is dropped, and bits 0-29 the
+ * other three, 10 bits each, in [-1/sqrt(2), 1/sqrt(2)]. q and -q are the
+ * same rotation, so the largest component is made positive. the error per
+ * component is at most 0.0007, about the rounding of 3 decimals.
+ */
+uint32_t packQuaternion(const Quaternion& q);
+
+/**
+ * @returns the unit quaternion packed by packQuaternion()
+ */
+Quaternion unpackQuaternion(uint32_t packed);
+
+/**
+ * codes positions (in mm) as deltas from a keyframe. every
+ * keyframeInterval positions, or if a delta does not fit, the position is
+ * sent as keyframe:
+ *   byte 0      0x80 | keyframe id (7 bits)
+ *   bytes 1-12  x, y, z, float32
+ * otherwise as delta from the keyframe, in units of 0.1 mm:
+ *   byte 0      keyframe id
+ *   bytes 1-6   dx, dy, dz, int16
+ * a delta is relative to the keyframe, not to the previous position, so a
+ * lost frame only loses the deltas if it was the keyframe.
+ * the encoder and the decoder each use an instance.
+ */
+class PositionCodec {
+
+public:
+
+  /** number of positions from one keyframe to the next */
+  int keyframeInterval;
+
+  PositionCodec(int keyframeInterval = 100);
+
+  /**
+   * @param[out] out - at least 13 bytes
+   * @returns number of bytes written
+   */
+  int encode(const double position[3], uint8_t* out);
+
+  /**
+   * @param[out] position - decoded position in mm
+   * @returns number of bytes read, or 0 if the keyframe of a delta has not
+   *   been received
+   */
+  int decode(const uint8_t* in, int length, double position[3]);
+
+private:
+
+  /** last keyframe, as float like in the frame */
+  float keyframe[3];
+
+  /** id of the last keyframe, -1 if there is none */
+  int keyframeId;
+
+  /** positions encoded since the last keyframe */
+  int count;
+
+};
+
+class Telemetry {
+
+public:
+
+  /**
+   * @param binary - true: send binary frames, false: send text lines
+   */
+  Telemetry(bool binary = true) :
+    binary(binary), quantized(false), subscriptions(TM_ALL), skip(false), length(0),
+    rxLength(0), rxOverflow(false), nFrames(0), nCommands(0), nCommandErrors(0) {}
+
+  void setBinary(bool binary_) { binary = binary_; }
+
+  bool isBinary() const { return binary; }
+
+  /**
+   * @param quantized - if true, binary frames pack quaternions and
+   *   positions, see TM_QUANTIZED. ignored in text mode
+   */
+  void setQuantized(bool quantized_) { quantized = quantized_; }
+
+  bool isQuantized() const { return quantized; }
+
+  /**
+   * @param mask - bitwise or of telemetryMask() of the message types to
+   *   send. TM_TEXT, TM_CONFIG and TM_COUNTERS are always sent
+   */
+  void setSubscriptions(uint32_t mask) { subscriptions = mask; }
+
+  uint32_t getSubscriptions() const { return subscriptions; }
+
+  /** @returns true if messages of the type are sent */
+  bool isSubscribed(TelemetryType type) const {
+    return type == TM_TEXT || type == TM_CONFIG || type == TM_COUNTERS ||
+      (subscriptions & telemetryMask(type)) != 0;
+  }
+
+  /**
+   * reads the bytes available from the serial port, without blocking
+   * @param[out] command - the command, if one was completed
+   * @returns true if a valid command was completed. invalid frames, also
+   *   CMD_KEY without the key, are counted and ignored. empty frames
+   *   (two delimiters in a row) are skipped without counting
+   */
+  bool readCommand(Command& command);
+
+  /** @returns number of messages sent since start */
+  uint32_t getFramesSent() const { return nFrames; }
+
+  /** @returns number of valid commands received since start */
+  uint32_t getCommandsReceived() const { return nCommands; }
+
+  /** @returns number of invalid command frames received since start */
+  uint32_t getCommandErrors() const { return nCommandErrors; }
+
+  /**
+   * starts a message. in text mode, the tag is printed. if the type is
+   * not subscribed, the message is dropped up to end().
+   * @param type - type of the message
+   * @param timestamp - time the message refers to, in us
+   */
+  void begin(TelemetryType type, uint64_t timestamp);
+
+  /**
+   * appends a float field
+   * @param decimals - decimals printed in text mode
+   */
+  void addFloat(double value, int decimals = 3);
+
+  void addInt(int32_t value);
+
+  void addUint(uint32_t value);
+
+  /** appends a quaternion, packed if quantization is enabled */
+  void addQuaternion(const Quaternion& q);
+
+  /**
+   * appends a position in mm, delta coded if quantization is enabled.
+   * all positions share one PositionCodec, send them in one message type
+   */
+  void addPosition(const double position[3]);
+
+  /**
+   * ends the message and sends the frame. in text mode, ends the line.
+   * TM_TI and TM_TL have no fields, in text mode their timestamp is
+   * printed in s.
+   */
+  void end();
+
+  /**
+   * sends a line of free text, e.g. a status message
+   */
+  void text(const char* message);
+
+private:
+
+  /** true if frames are sent, false if text is printed */
+  bool binary;
+
+  /** true if quaternions and positions are packed */
+  bool quantized;
+
+  /** encoder of the positions, if quantized */
+  PositionCodec positionCodec;
+
+  /** mask of the subscribed message types */
+  uint32_t subscriptions;
+
+  /** true if the current message is not subscribed */
+  bool skip;
+
+  /** frame being built, before encoding */
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+
+  /** number of bytes in frame */
+  int length;
+
+  /** type and timestamp of the current message, for the text mode */
+  TelemetryType type;
+  uint64_t timestamp;
+
+  /** command frame being received, still encoded */
+  uint8_t rx[TELEMETRY_MAX_COMMAND + 4];
+
+  /** number of bytes in rx */
+  int rxLength;
+
+  /** true if the command being received does not fit in rx */
+  bool rxOverflow;
+
+  /** counters of frames sent, valid and invalid commands */
+  uint32_t nFrames;
+  uint32_t nCommands;
+  uint32_t nCommandErrors;
+
+  /** decodes the command frame in rx. @returns true if it is valid */
+  bool decodeCommand(Command& command);
+
+  /** appends a uint32 to the frame, little endian */
+  void put32(uint32_t value);
+
+  /** appends n bytes to the frame */
+  void put(const uint8_t* data, int n);
+
+  /** appends the CRC, encodes the frame and writes it to the serial port */
+  void send();
+
+};
+
+/**
+ * @returns CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+ */
+uint16_t crc16(const uint8_t* data, int length);
+
+/**
+ * COBS encodes data. the output has no 0 bytes and is not terminated.
+ * @param[out] out - must hold length + length / 254 + 1 bytes
+ * @returns number of bytes written to out
+ */
+int cobsEncode(const uint8_t* data, int length, uint8_t* out);
+
+/**
+ * decodes COBS encoded data, without the terminating 0
+ * @param[out] out - must hold length bytes
+ * @returns number of bytes written to out, -1 if the data is invalid
+ */
+int cobsDecode(const uint8_t* data, int length, uint8_t* out);
+
+#endif // ifndef TELEMETRY_H
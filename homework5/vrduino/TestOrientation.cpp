@@ -88,13 +88,260 @@ bool test6() {
   return quaternionNear(q5, qExp);
 }
 
+/* setEstimators() */
+bool test7() {
+  OrientationTracker all(0.9, true);
+  OrientationTracker comp(0.9, true, EST_QUATERNION_COMP);
+  for (int i = 0; i < 200; i++) {
+    all.processImu();
+    comp.processImu();
+  }
+  Quaternion qAll = all.getQuaternionComp();
+  Quaternion qComp = comp.getQuaternionComp();
+  Serial.println("Quaternion of the comp filter, all estimators:");
+  qAll.serialPrint();
+  Serial.println("Quaternion of the comp filter only: ");
+  qComp.serialPrint();
+  Serial.printf("Cycles per sample, all estimators: %lu, comp filter only: %lu\n",
+    (unsigned long)all.getOrientationCycles().average(),
+    (unsigned long)comp.getOrientationCycles().average());
+  Serial.println();
+  return quaternionNear(qAll, qComp) &&
+    comp.isCurrent(EST_QUATERNION_COMP) && !comp.isCurrent(EST_QUATERNION_GYR);
+}
+
+/* GyroBiasModel */
+bool test8() {
+  GyroBiasModel model;
+  double bias[3] = {1, 0.2, 0};
+  model.setBias(bias, 30);
+  double acc[3] = {0, 9.80665, 0};
+  double gyr[3] = {0, 0, 0};
+
+  // stationary periods while the imu warms up from 30 to 40 deg C
+  for (double t = 30; t <= 40; t += 0.5) {
+    gyr[0] = 1 + 0.05 * (t - 30);
+    gyr[1] = 0.2 - 0.02 * (t - 30);
+    for (int i = 0; i < 500; i++) {
+      model.addSample(gyr, acc, t);
+    }
+  }
+  unsigned long updates = model.getUpdates();
+
+  // a period with motion is not learned
+  for (int i = 0; i < 500; i++) {
+    gyr[2] = (i == 250) ? 30 : 0;
+    model.addSample(gyr, acc, 40);
+  }
+
+  // a slow rotation within 1 deg/s is not learned, its rate changes. a
+  // period with noise like at rest is
+  GyroBiasModel still;
+  double zero[3] = {0, 0, 0};
+  double variance[3] = {0.01, 0.01, 0.01};
+  still.setVariance(variance);
+  still.setBias(zero, 30, 1000);
+  for (int i = 0; i < 500; i++) {
+    gyr[0] = 0;
+    gyr[1] = 0;
+    gyr[2] = 0.7 * sin(PI * i / 500);
+    still.addSample(gyr, acc, 30);
+  }
+  unsigned long rotationUpdates = still.getUpdates();
+  for (int i = 0; i < 500; i++) {
+    gyr[2] = (i % 2) ? 0.1 : -0.1;
+    still.addSample(gyr, acc, 30);
+  }
+
+  double biasExp[3] = {1.5, 0, 0};
+  model.computeBias(40, bias);
+  Serial.println("Expected gyro bias slope, bias at 40 deg C, periods:");
+  Serial.printf("%f %f %f, %f %f %f, %d\n", 0.05, -0.02, 0.0,
+    biasExp[0], biasExp[1], biasExp[2], 21);
+  Serial.println("Your result: ");
+  Serial.printf("%f %f %f, %f %f %f, %lu\n", model.getSlope()[0],
+    model.getSlope()[1], model.getSlope()[2], bias[0], bias[1], bias[2],
+    model.getUpdates());
+  Serial.println("Expected periods learned with a slow rotation, with noise:");
+  Serial.printf("%d %d\n", 0, 1);
+  Serial.println("Your result: ");
+  Serial.printf("%lu %lu\n", rotationUpdates, still.getUpdates());
+  Serial.println();
+  return doubleNear(model.getSlope()[0], 0.05) && doubleNear(model.getSlope()[1], -0.02) &&
+    doubleNear(bias[0], biasExp[0]) && doubleNear(bias[1], biasExp[1]) &&
+    updates == 21 && model.getUpdates() == 21 &&
+    rotationUpdates == 0 && still.getUpdates() == 1;
+}
+
+/**
+ * runs a filter of OrientationFilter.h over the simulated imu data and
+ * prints the cycles per sample, and the tilt error: the angle between the
+ * acc rotated to the world frame and the world y-axis. the acc also
+ * measures the motion, so the error of an exact filter is not 0, but it
+ * is comparable between the filters. all filters start at the tilt of
+ * the first acc sample
+ */
+template <class Filter>
+void benchmarkFilter(Filter filter, const char* name) {
+
+  Quaternion q;
+  double normA0 = sqrt(sq(imuData[3]) + sq(imuData[4]) + sq(imuData[5]));
+  double normN0 = sqrt(sq(imuData[3]) + sq(imuData[5]));
+  if (normN0 >= 1e-8) {
+    q.setFromAngleAxis(RAD_TO_DEG * acos(imuData[4] / normA0),
+      -imuData[5] / normN0, 0, imuData[3] / normN0);
+  }
+  CycleStats cycles;
+  double gyr[3];
+  double acc[3];
+  double errorSquaredSum = 0;
+  double errorMax = 0;
+  int n = nImuSamples / 6;
+
+  for (int i = 0; i < n; i++) {
+
+    for (int j = 0; j < 3; j++) {
+      gyr[j] = imuData[6 * i + j];
+      acc[j] = imuData[6 * i + 3 + j];
+    }
+
+    uint32_t startCycles = getCycleCount();
+    filter.update(q, gyr, acc, 0.002);
+    cycles.add(getCycleCount() - startCycles);
+
+    Quaternion qa = Quaternion(0, acc[0], acc[1], acc[2]).rotate(q);
+    double normA = sqrt(sq(qa.q[1]) + sq(qa.q[2]) + sq(qa.q[3]));
+    double error = RAD_TO_DEG * acos(constrain(qa.q[2] / normA, -1.0, 1.0));
+    errorSquaredSum += sq(error);
+    errorMax = max(errorMax, error);
+
+  }
+
+  Serial.printf("%-14s cycles avg %6lu max %6lu, tilt error rms %6.2f max %6.2f deg\n",
+    name, (unsigned long)cycles.average(), (unsigned long)cycles.max,
+    sqrt(errorSquaredSum / n), errorMax);
+
+}
+
+/** benchmarks a filter of OrientationFilter.h with its default parameters */
+template <class Filter>
+void benchmarkFilter(double alpha) {
+  benchmarkFilter(Filter(alpha), Filter::name());
+}
+
+/** benchmarks all filters of OrientationFilter.h */
+void benchmarkFilters() {
+
+  Serial.printf("Orientation filters over %d simulated samples:\n", nImuSamples / 6);
+  benchmarkFilter<GyroFilter>(0.9);
+  benchmarkFilter<ComplementaryFilter>(0.9);
+  benchmarkFilter<MahonyFilter>(0.9);
+  benchmarkFilter<MadgwickFilter>(0.9);
+
+  ComplementaryFilter decimated(0.9);
+  decimated.setCorrectionInterval(4);
+  benchmarkFilter(decimated, "comp 1/4");
+  decimated.setCorrectionInterval(8);
+  benchmarkFilter(decimated, "comp 1/8");
+  decimated.setAccTolerance(0.1);
+  benchmarkFilter(decimated, "comp 1/8 10%");
+  Serial.println();
+
+}
+
+/**
+ * integrates the gyro of the simulated imu data with a GyroIntegration
+ * method, using every decimation-th sample, and prints the cycles per
+ * sample and the error to the reference: the simulated rates, linearly
+ * interpolated, integrated with 8 RK4 steps per sample
+ */
+void benchmarkGyroIntegration(GyroIntegration integration, int decimation, const char* name) {
+
+  const double deltaT = 0.002;
+  const int subSteps = 8;
+  GyroIntegrator integrator;
+  integrator.setIntegration(integration);
+  Quaternion q;
+  Quaternion qRef;
+  CycleStats cycles;
+  double gyr[3] = {0, 0, 0};
+  double gyrPrev[3];
+  double gyrA[3];
+  double gyrB[3];
+  double errorSquaredSum = 0;
+  double error = 0;
+  int nErrors = 0;
+  int n = nImuSamples / 6;
+
+  for (int i = 0; i < n; i++) {
+
+    for (int j = 0; j < 3; j++) {
+      gyrPrev[j] = gyr[j];
+      gyr[j] = imuData[6 * i + j];
+    }
+
+    // the first sample only sets the previous sample of the integrator
+    if (i == 0) {
+      integrator.update(q, gyr, 0);
+      continue;
+    }
+
+    // reference
+    for (int s = 0; s < subSteps; s++) {
+      for (int j = 0; j < 3; j++) {
+        gyrA[j] = gyrPrev[j] + (gyr[j] - gyrPrev[j]) * s / subSteps;
+        gyrB[j] = gyrPrev[j] + (gyr[j] - gyrPrev[j]) * (s + 1) / subSteps;
+      }
+      updateQuaternionGyrRk4(qRef, gyrA, gyrB, deltaT / subSteps);
+    }
+
+    if (i % decimation != 0) {
+      continue;
+    }
+
+    uint32_t startCycles = getCycleCount();
+    integrator.update(q, gyr, deltaT * decimation);
+    cycles.add(getCycleCount() - startCycles);
+
+    double dot = fabs(q.q[0] * qRef.q[0] + q.q[1] * qRef.q[1] +
+      q.q[2] * qRef.q[2] + q.q[3] * qRef.q[3]);
+    error = 2 * RAD_TO_DEG * acos(min(dot, 1.0));
+    errorSquaredSum += sq(error);
+    nErrors++;
+
+  }
+
+  Serial.printf("%-14s %4d Hz cycles avg %6lu, error rms %7.4f final %7.4f deg\n",
+    name, (int)(1 / (deltaT * decimation)), (unsigned long)cycles.average(),
+    sqrt(errorSquaredSum / nErrors), error);
+
+}
+
+/** compares the methods of GyroIntegrator at sample rates down to 125 Hz */
+void benchmarkGyroIntegrations() {
+
+  Serial.printf("Gyro integration over %d simulated samples:\n", nImuSamples / 6);
+  for (int decimation = 1; decimation <= 4; decimation *= 2) {
+    benchmarkGyroIntegration(GYRO_FIRST_ORDER, decimation, "first order");
+    benchmarkGyroIntegration(GYRO_CONING, decimation, "coning");
+    benchmarkGyroIntegration(GYRO_RK4, decimation, "rk4");
+  }
+  Serial.println();
+
+}
+
 /** run all tests */
 void testMain() {
 
   Serial.printf("Testing quaternion:\n\n");
+  enableCycleCounter();
   int res = test1() + test2() + test3() + test4()
-    + test5() + test6();
-  Serial.printf("total passes: %d/6\n", res);
+    + test5() + test6() + test7() + test8();
+  Serial.printf("total passes: %d/8\n", res);
+  Serial.println();
+
+  benchmarkFilters();
+  benchmarkGyroIntegrations();
 
 
 }
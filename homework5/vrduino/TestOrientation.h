@@ -1,5 +1,5 @@
 /**
-  * Unit tests for the Quaternion, and OrientationMath
+  * Unit tests for the Quaternion, OrientationMath, and OrientationTracker
   *
   * These functions would be helpful for debugging your implementation.
  */
@@ -8,6 +8,8 @@
 
 #include "Quaternion.h"
 #include "OrientationMath.h"
+#include "OrientationTracker.h"
+#include "OrientationFilter.h"
 #include "TestUtil.h"
 
 bool test1();
@@ -16,4 +18,8 @@ bool test3();
 bool test4();
 bool test5();
 bool test6();
+bool test7();
+bool test8();
+void benchmarkFilters();
+void benchmarkGyroIntegrations();
 void testMain();
@@ -21,6 +21,9 @@
 #include <Wire.h>
 #include "OrientationTracker.h"
 #include "TestOrientation.h"
+#include "Telemetry.h"
+#include "RateScheduler.h"
+#include "CycleCounter.h"
 
 //complementary filter value [0,1].
 //1: ignore acc tilt, 0: use all acc tilt
@@ -33,15 +36,35 @@ bool simulateImu = false;
 //if test is true, then run tests in TestOrientation.cpp and exit
 bool test = false;
 
+//if true, send binary frames (see Telemetry.h), which server.js converts
+//to text for the browser. if false, print text. must match server.js
+bool binaryTelemetry = true;
+
+//if true, binary frames pack quaternions into 32 bits. the precision is
+//about that of 3 decimals
+bool quantizeTelemetry = true;
+
 //if measureImuBias is true, measure imu bias and variance
 bool measureImuBias = true;
 
 //if measureBias is false, set the imu bias to the following:
 double gyrBiasSet[3] = {1.29472, 0.10846, 1.05350};
 
+//imu temperature in deg C at which gyrBiasSet was measured, NAN: unknown,
+//and the change of the gyro bias per deg C. the learned values are sent
+//in GYR_TEMP with the INFO values
+double gyrBiasTemperatureSet = NAN;
+double gyrBiasSlopeSet[3] = {0, 0, 0};
+
+//if true, learn the gyro bias over the imu temperature while the imu is
+//stationary, so that the bias does not have to be measured again
+bool learnGyrBias = true;
+
 //initialize orientation tracker
 OrientationTracker tracker(alphaImuFilter, simulateImu);
 
+Telemetry telemetry(binaryTelemetry);
+
 //stream mode
 //To change what the Teensy is printing out, set streamMode
 //to one of the following values.
@@ -70,9 +93,161 @@ const int QC     = 5;
 //chose which values you want to stream
 int streamMode = INFO;
 
-//variables to measure read frequency
-int nReads = 0;
-unsigned long prevTime = 0;
+//message types sent in each streamMode, bitwise or of telemetryMask().
+//the host can also subscribe to any combination of them and change the
+//rates with the commands in Telemetry.h
+const uint32_t infoMask = telemetryMask(TM_NREADS) | telemetryMask(TM_NLOOPS) |
+  telemetryMask(TM_CY) | telemetryMask(TM_GYR_TEMP) |
+  telemetryMask(TM_GYR_BIAS) | telemetryMask(TM_GYR_VAR) |
+  telemetryMask(TM_ACC_BIAS) | telemetryMask(TM_ACC_VAR);
+const uint32_t streamModeMasks[] = {
+  infoMask,
+  telemetryMask(TM_FLAT),
+  telemetryMask(TM_QG) | telemetryMask(TM_EA) | telemetryMask(TM_QC),
+  telemetryMask(TM_GYR),
+  telemetryMask(TM_ACC),
+  telemetryMask(TM_QC)
+};
+
+//rate in Hz of the values of streamMode, 0: send every imu sample.
+//the imu is processed as fast as its data arrives
+double streamRate = 500;
+
+//rate in Hz of the INFO values
+double infoRate = 1;
+
+RateScheduler streamScheduler(streamRate);
+RateScheduler infoScheduler(infoRate);
+
+//streams indexed as in CMD_SET_RATE and TM_CONFIG
+RateScheduler* streams[] = {&streamScheduler, &infoScheduler};
+const int nStreams = 2;
+
+//variables to measure read frequency and iterations of loop(): counts
+//since start, and their values at the last INFO
+unsigned long nReads = 0;
+unsigned long nLoops = 0;
+unsigned long prevReads = 0;
+unsigned long prevLoops = 0;
+uint64_t prevTime = 0;
+
+//cycles spent sending the messages of an imu sample
+CycleStats outputCycles;
+
+//micros() extended to 64 bit, so the timestamps of the messages do not
+//wrap around after ~71 minutes. call at least once per wrap, loop() does
+uint64_t micros64() {
+  static uint32_t low = 0;
+  static uint32_t high = 0;
+  uint32_t now = micros();
+  if (now < low) {
+    high++;
+  }
+  low = now;
+  return ((uint64_t)high << 32) | now;
+}
+
+//sends a message with the 3 values of v
+void sendVector(TelemetryType type, uint64_t timestamp, const double* v, int decimals) {
+  telemetry.begin(type, timestamp);
+  for (int i = 0; i < 3; i++) {
+    telemetry.addFloat(v[i], decimals);
+  }
+  telemetry.end();
+}
+
+//sends a message with the quaternion q
+void sendQuaternion(TelemetryType type, uint64_t timestamp, const Quaternion& q) {
+  telemetry.begin(type, timestamp);
+  telemetry.addQuaternion(q);
+  telemetry.end();
+}
+
+//enables the orientation estimators of the subscribed messages, the
+//others are not computed
+void updateEstimators() {
+
+  uint32_t mask = telemetry.getSubscriptions();
+  int estimators = 0;
+  if (mask & telemetryMask(TM_FLAT)) {
+    estimators |= EST_FLATLAND_GYR | EST_FLATLAND_ACC | EST_FLATLAND_COMP;
+  }
+  if (mask & telemetryMask(TM_QG)) {
+    estimators |= EST_QUATERNION_GYR;
+  }
+  if (mask & telemetryMask(TM_EA)) {
+    estimators |= EST_EULER_ACC;
+  }
+  if (mask & telemetryMask(TM_QC)) {
+    estimators |= EST_QUATERNION_COMP;
+  }
+  tracker.setEstimators(estimators);
+
+}
+
+//executes a command from the host
+void handleCommand(const Command& command) {
+
+  if (command.type == CMD_KEY) {
+
+    int read = command.payload[0];
+
+    //check for streamMode
+    int modeRead = read - 48;
+
+    if (modeRead >= 0 && modeRead <= 5) {
+
+      streamMode = modeRead;
+      telemetry.setSubscriptions(streamModeMasks[streamMode]);
+      updateEstimators();
+
+    } else  if (read == 'r') {
+
+      //reset orientation estimate to 0
+      tracker.resetOrientation();
+
+    } else if (read == 'b') {
+
+      //measure imu bias
+      telemetry.text("Measuring bias");
+      tracker.measureImuBiasVariance();
+
+    }
+
+  } else if (command.type == CMD_SUBSCRIBE) {
+
+    telemetry.setSubscriptions(command.getUint(0));
+    updateEstimators();
+
+  } else if (command.type == CMD_SET_RATE) {
+
+    if (command.length >= 5 && command.payload[0] < nStreams) {
+      streams[command.payload[0]]->setRate(command.getFloat(1));
+    }
+
+  } else if (command.type == CMD_GET_CONFIG) {
+
+    telemetry.begin(TM_CONFIG, micros64());
+    telemetry.addUint(telemetry.getSubscriptions());
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++) {
+      telemetry.addFloat(i < nStreams ? streams[i]->getRate() : 0, 2);
+    }
+    telemetry.end();
+
+  } else if (command.type == CMD_GET_COUNTERS) {
+
+    telemetry.begin(TM_COUNTERS, micros64());
+    telemetry.addUint(nLoops);
+    telemetry.addUint(nReads);
+    telemetry.addUint(0);
+    telemetry.addUint(telemetry.getFramesSent());
+    telemetry.addUint(telemetry.getCommandsReceived());
+    telemetry.addUint(telemetry.getCommandErrors());
+    telemetry.end();
+
+  }
+
+}
 
 //runs when the Teensy is powered on
 void setup() {
@@ -88,76 +263,94 @@ void setup() {
 
   }
 
+  telemetry.setQuantized(quantizeTelemetry);
+  telemetry.setSubscriptions(streamModeMasks[streamMode]);
+  updateEstimators();
   tracker.initImu();
 
   if (measureImuBias) {
 
-    Serial.printf("Measuring bias\n");
+    telemetry.text("Measuring bias");
     tracker.measureImuBiasVariance();
 
   } else {
 
-    tracker.setImuBias(gyrBiasSet);
+    tracker.setImuBias(gyrBiasSet, gyrBiasTemperatureSet);
 
   }
 
-  prevTime = micros();
+  tracker.setImuBiasSlope(gyrBiasSlopeSet);
+  tracker.setGyrBiasLearning(learnGyrBias);
+
+  prevTime = micros64();
 
 }
 
 void loop() {
 
-  //reads in a single char to update behaviour. options:
+  //reads commands to update behaviour. options of the text protocol
+  //and of CMD_KEY:
   //0-5: set streamMode. See mapping above.
   //r  : reset orientation estimates to 0.
   //b  : remeasure bias
-  if (Serial.available()) {
-
-    int read = Serial.read();
-
-    //check for streamMode
-    int modeRead = read - 48;
-
-    if (modeRead >= 0 && modeRead <= 5) {
-
-      streamMode = modeRead;
-
-    } else  if (read == 'r') {
-
-      //reset orientation estimate to 0
-      tracker.resetOrientation();
-
-    } else if (read == 'b') {
-
-      //measure imu bias
-      Serial.printf("Measuring bias\n");
-      tracker.measureImuBiasVariance();
-
-    }
+  Command command;
+  while (telemetry.readCommand(command)) {
+    handleCommand(command);
   }
 
   if (test) {
     return;
   }
 
-  if (streamMode == INFO) {
-    //print out number of reads / sec
-    unsigned long now = micros();
-    if ((now - prevTime) > 1000000) {
-      Serial.printf("nReads/sec: %d\n", nReads);
-      nReads = 0;
+  nLoops++;
+
+  //read every iteration, so that micros64() sees every wrap around
+  uint64_t now = micros64();
+
+  if (telemetry.getSubscriptions() & infoMask) {
+    //print out number of reads and loop iterations / sec
+    if (infoScheduler.due((uint32_t)now)) {
+      double seconds = (now - prevTime) / 1000000.0;
+      telemetry.begin(TM_NREADS, now);
+      telemetry.addUint((nReads - prevReads) / seconds);
+      telemetry.end();
+      telemetry.begin(TM_NLOOPS, now);
+      telemetry.addUint((nLoops - prevLoops) / seconds);
+      telemetry.end();
+      prevReads = nReads;
+      prevLoops = nLoops;
       prevTime = now;
 
-      //print out bias/variance
-      const double* gyrBias = tracker.getGyrBias();
-      const double* gyrVariance = tracker.getGyrVariance();
-      Serial.printf("GYR_BIAS: %.5f %.5f %.5f\n", gyrBias[0], gyrBias[1], gyrBias[2]);
-      Serial.printf("GYR_VAR: %.5f %.5f %.5f\n", gyrVariance[0], gyrVariance[1], gyrVariance[2]);
+      //cycles per imu sample of the enabled estimators and of the output.
+      //there is no position filter and no EKF in this sketch
+      telemetry.begin(TM_CY, now);
+      telemetry.addUint(tracker.getOrientationCycles().average());
+      telemetry.addUint(0);
+      telemetry.addUint(0);
+      telemetry.addUint(outputCycles.average());
+      telemetry.end();
+      tracker.resetCycleStats();
+      outputCycles.reset();
 
-      const double* accBias = tracker.getAccBias();
-      const double* accVariance = tracker.getAccVariance();
-      Serial.printf("ACC_BIAS: %.3f %.3f %.3f\n", accBias[0], accBias[1], accBias[2]);
-      Serial.printf("ACC_VAR: %.3f %.3f %.3f\n", accVariance[0], accVariance[1], accVariance[2]);
+      //print out bias/variance
+      sendVector(TM_GYR_BIAS, now, tracker.getGyrBias(), 5);
+      sendVector(TM_GYR_VAR, now, tracker.getGyrVariance(), 5);
+      sendVector(TM_ACC_BIAS, now, tracker.getAccBias(), 3);
+      sendVector(TM_ACC_VAR, now, tracker.getAccVariance(), 3);
+
+      //print out the imu temperature and the model of the gyro bias over it
+      const GyroBiasModel& gyrBiasModel = tracker.getGyrBiasModel();
+      telemetry.begin(TM_GYR_TEMP, now);
+      telemetry.addFloat(tracker.getImuTemperature(), 2);
+      telemetry.addFloat(gyrBiasModel.getTemperature(), 2);
+      for (int i = 0; i < 3; i++) {
+        telemetry.addFloat(gyrBiasModel.getBias()[i], 5);
+      }
+      for (int i = 0; i < 3; i++) {
+        telemetry.addFloat(gyrBiasModel.getSlope()[i], 5);
+      }
+      telemetry.addUint(gyrBiasModel.getUpdates());
+      telemetry.end();
 
     }
   }
@@ -170,57 +363,62 @@ void loop() {
   }
 
   nReads++;
+  now = micros64();
+
+  //return if the stream is not due
+  if (!streamScheduler.due((uint32_t)now)) {
+    return;
+  }
 
-  //get relevant values from the tracker class
-  double flatlandRollGyr = tracker.getFlatLandRollGyr();
-  double flatlandRollAcc = tracker.getFlatLandRollAcc();
-  double flatlandRollComp = tracker.getFlatLandRollComp();
-  const double* acc = tracker.getAcc();
-  const double* gyr = tracker.getGyr();
-  const Quaternion& qGyr = tracker.getQuaternionGyr();
-  const double* eulerAcc = tracker.getEulerAcc();
-  const Quaternion& qComp = tracker.getQuaternionComp();
+  //send the subscribed values
+  uint32_t outputStart = getCycleCount();
 
-  if (streamMode == FLAT) {
+  if (telemetry.isSubscribed(TM_FLAT)) {
 
     //print out flatland roll
-    Serial.printf("FLAT %.3f %.3f %.3f\n",
-      flatlandRollGyr, flatlandRollAcc, flatlandRollComp);
+    telemetry.begin(TM_FLAT, now);
+    telemetry.addFloat(tracker.getFlatLandRollGyr());
+    telemetry.addFloat(tracker.getFlatLandRollAcc());
+    telemetry.addFloat(tracker.getFlatLandRollComp());
+    telemetry.end();
+
+  }
 
-  } else if (streamMode == THREED) {
+  if (telemetry.isSubscribed(TM_QG)) {
 
     //quat values from gyro
-    Serial.printf("QG %.3f %.3f %.3f %.3f\n",
-      qGyr.q[0], qGyr.q[1], qGyr.q[2], qGyr.q[3]);
+    sendQuaternion(TM_QG, now, tracker.getQuaternionGyr());
+
+  }
+
+  if (telemetry.isSubscribed(TM_EA)) {
 
     //euler values from acc
-    Serial.printf("EA %.3f %.3f %.3f\n",
-      eulerAcc[0], eulerAcc[1], eulerAcc[2]);
+    sendVector(TM_EA, now, tracker.getEulerAcc(), 3);
+
+  }
+
+  if (telemetry.isSubscribed(TM_QC)) {
 
     //quat values from comp filter
-    Serial.printf("QC %.3f %.3f %.3f %.3f\n",
-      qComp.q[0], qComp.q[1], qComp.q[2], qComp.q[3]);
+    sendQuaternion(TM_QC, now, tracker.getQuaternionComp());
 
-  } else if (streamMode == GYR) {
+  }
 
-    //print out gyr values
-    Serial.printf("GYR: %.3f %.3f %.3f\n",
-      gyr[0], gyr[1], gyr[2]);
+  if (telemetry.isSubscribed(TM_GYR)) {
 
-  } else if (streamMode == ACC) {
+    //print out gyr values
+    sendVector(TM_GYR, now, tracker.getGyr(), 3);
 
-    //print out acc values
-    Serial.printf("ACC: %.3f %.3f %.3f\n",
-      acc[0], acc[1], acc[2]);
+  }
 
-  } else if (streamMode == QC) {
+  if (telemetry.isSubscribed(TM_ACC)) {
 
-    //just print out comp filter
-    Serial.printf("QC %.3f %.3f %.3f %.3f\n",
-      qComp.q[0], qComp.q[1], qComp.q[2], qComp.q[3]);
+    //print out acc values
+    sendVector(TM_ACC, now, tracker.getAcc(), 3);
 
   }
 
-  delay(10);
+  outputCycles.add(getCycleCount() - outputStart);
 
 }
@@ -39,6 +39,77 @@ var wssConnections = [];
 var printData = true;
 
 
+// Set to the value of binaryTelemetry in vrduino.ino.
+// true: the Teensy sends COBS encoded binary frames, which are converted to
+// the text messages for the browser. false: the Teensy sends text lines.
+var binaryTelemetry = true;
+
+
+// Version of the binary frame layout, TELEMETRY_VERSION in Telemetry.h
+const TELEMETRY_VERSION = 2;
+
+// Tags and payload fields of the binary messages, indexed by TelemetryType in
+// Telemetry.h. Fields are "f<decimals>" (float32), "i" (int32), "u" (uint32),
+// "q" (quaternion, 4 float32) and "p" (position, 3 float32). If the type has
+// the TM_QUANTIZED flag, "q" is packed into 32 bits and "p" is delta coded.
+// A message without fields prints its timestamp in s.
+const telemetryFormats = [
+	[ "", [] ],
+	[ "BS", [ "f3", "f3", "i" ] ],
+	[ "NP", [ "u", "u", "u", "u", "u", "u", "u", "u" ] ],
+	[ "TL", [] ],
+	[ "PS", [ "p" ] ],
+	[ "QH", [ "q" ] ],
+	[ "PD", [ "f3", "f3", "f3", "f3", "f3", "f3", "f3", "f3" ] ],
+	[ "VP", [ "i", "i" ] ],
+	[ "LS", [ "i", "u", "u", "u", "f2" ] ],
+	[ "CY", [ "u", "u", "u", "u" ] ],
+	[ "TI", [] ],
+	[ "QC", [ "q" ] ],
+	[ "QG", [ "q" ] ],
+	[ "EA", [ "f3", "f3", "f3" ] ],
+	[ "FLAT", [ "f3", "f3", "f3" ] ],
+	[ "GYR:", [ "f3", "f3", "f3" ] ],
+	[ "ACC:", [ "f3", "f3", "f3" ] ],
+	[ "nReads/sec:", [ "u" ] ],
+	[ "GYR_BIAS:", [ "f5", "f5", "f5" ] ],
+	[ "GYR_VAR:", [ "f5", "f5", "f5" ] ],
+	[ "ACC_BIAS:", [ "f3", "f3", "f3" ] ],
+	[ "ACC_VAR:", [ "f3", "f3", "f3" ] ],
+	[ "LR", [ "u", "u", "u" ] ],
+	[ "nLoops/sec:", [ "u" ] ],
+	[ "CF", [ "u", "f2", "f2", "f2", "f2" ] ],
+	[ "CN", [ "u", "u", "u", "u", "u", "u" ] ],
+	[ "GYR_TEMP:", [ "f2", "f2", "f5", "f5", "f5", "f5", "f5", "f5", "u" ] ]
+];
+
+// Commands to the Teensy, CommandType in Telemetry.h
+const CMD_KEY = 0;
+const CMD_SUBSCRIBE = 1;
+const CMD_SET_RATE = 2;
+const CMD_GET_CONFIG = 3;
+const CMD_GET_COUNTERS = 4;
+
+// Flag in the type of frames with packed quaternions and positions
+const TM_QUANTIZED = 0x80;
+
+// Range of the three smallest components of a unit quaternion
+const QUATERNION_RANGE = Math.SQRT1_2;
+
+// Resolution of the position deltas in mm
+const POSITION_DELTA_STEP = 0.1;
+
+// Last position keyframe, see PositionCodec in Telemetry.h
+var positionKeyframe = null;
+var positionKeyframeId = - 1;
+
+// Number of frames dropped because of a wrong CRC, version or length
+var droppedFrames = 0;
+
+// Open serial port to the Teensy, null if there is none
+var openSerialPort = null;
+
+
 // Event listner of the WebSocketServer.
 wss.on( "connection", function ( client ) {
 
@@ -46,6 +117,30 @@ wss.on( "connection", function ( client ) {
 
 	wssConnections.push( client );
 
+	// Commands from the browser as JSON, e.g.
+	//   { "subscribe": [ "QC", "PS" ] }  message types to send, by tag
+	//   { "rate": [ 0, 500 ] }           rate of stream 0 in Hz
+	//   { "config": true }               replies CF
+	//   { "counters": true }             replies CN
+	// Other messages are ignored.
+	client.on( "message", function ( message ) {
+
+		var command;
+
+		try {
+
+			command = JSON.parse( message );
+
+		} catch ( e ) {
+
+			return;
+
+		}
+
+		handleBrowserCommand( command );
+
+	} );
+
 	client.on( "close", function () {
 
 		console.log( "The connection to the browser is closed." );
@@ -123,10 +218,372 @@ function findSerialPort() {
 
 }
 
+// Decodes a COBS encoded frame without the terminating 0.
+// Returns null if the encoding is invalid.
+function cobsDecode( data ) {
+
+	var out = [];
+	var i = 0;
+
+	while ( i < data.length ) {
+
+		var code = data[ i ++ ];
+
+		if ( code == 0 || i + code - 1 > data.length ) {
+
+			return null;
+
+		}
+
+		for ( var j = 1; j < code; j ++ ) {
+
+			out.push( data[ i ++ ] );
+
+		}
+
+		if ( code < 0xFF && i < data.length ) {
+
+			out.push( 0 );
+
+		}
+
+	}
+
+	return Buffer.from( out );
+
+}
+
+// CRC-16/CCITT-FALSE, see crc16() in Telemetry.cpp
+function crc16( data, length ) {
+
+	var crc = 0xFFFF;
+
+	for ( var i = 0; i < length; i ++ ) {
+
+		crc ^= data[ i ] << 8;
+
+		for ( var b = 0; b < 8; b ++ ) {
+
+			crc = ( crc & 0x8000 ) ? ( ( crc << 1 ) ^ 0x1021 ) : ( crc << 1 );
+			crc &= 0xFFFF;
+
+		}
+
+	}
+
+	return crc;
+
+}
+
+// Unpacks a quaternion packed by packQuaternion() in Telemetry.cpp.
+// Returns the components w, x, y, z.
+function unpackQuaternion( packed ) {
+
+	var largest = packed >>> 30;
+	var q = [ 0, 0, 0, 0 ];
+	var shift = 20;
+	var sum = 0;
+
+	for ( var i = 0; i < 4; i ++ ) {
+
+		if ( i == largest ) continue;
+
+		var v = ( packed >>> shift ) & 0x3FF;
+		q[ i ] = v / 1023 * 2 * QUATERNION_RANGE - QUATERNION_RANGE;
+		sum += q[ i ] * q[ i ];
+		shift -= 10;
+
+	}
+
+	q[ largest ] = Math.sqrt( Math.max( 0, 1 - sum ) );
+
+	return q;
+
+}
+
+// Decodes a position coded by PositionCodec::encode() in Telemetry.cpp,
+// starting at offset. Returns the position and the number of bytes read,
+// or null if the keyframe of a delta was not received.
+function decodePosition( payload, offset ) {
+
+	var id = payload[ offset ];
+
+	if ( id & 0x80 ) {
+
+		if ( offset + 13 > payload.length ) return null;
+
+		positionKeyframeId = id & 0x7F;
+		positionKeyframe = [ 0, 1, 2 ].map( function ( i ) {
+
+			return payload.readFloatLE( offset + 1 + 4 * i );
+
+		} );
+
+		return { position: positionKeyframe.slice(), length: 13 };
+
+	}
+
+	if ( offset + 7 > payload.length || id != positionKeyframeId ) return null;
+
+	var position = [ 0, 1, 2 ].map( function ( i ) {
+
+		return positionKeyframe[ i ] + payload.readInt16LE( offset + 1 + 2 * i ) * POSITION_DELTA_STEP;
+
+	} );
+
+	return { position: position, length: 7 };
+
+}
+
+// Converts a binary frame to the text message of the same type.
+// Returns null if the frame is invalid.
+function decodeTelemetryFrame( encoded ) {
+
+	var frame = cobsDecode( encoded );
+
+	if ( frame == null || frame.length < 12 ||
+		frame[ 0 ] != TELEMETRY_VERSION ||
+		crc16( frame, frame.length - 2 ) != frame.readUInt16LE( frame.length - 2 ) ) {
+
+		return null;
+
+	}
+
+	var type = frame[ 1 ] & ~ TM_QUANTIZED;
+	var quantized = ( frame[ 1 ] & TM_QUANTIZED ) != 0;
+	// timestamp in us, uint64. a double is exact up to 2^53 us
+	var timestamp = frame.readUInt32LE( 2 ) + frame.readUInt32LE( 6 ) * 0x100000000;
+	var payload = frame.slice( 10, frame.length - 2 );
+
+	if ( type == 0 ) {
+
+		return payload.toString( "ascii" );
+
+	}
+
+	if ( type >= telemetryFormats.length ) {
+
+		return null;
+
+	}
+
+	var tag = telemetryFormats[ type ][ 0 ];
+	var fields = telemetryFormats[ type ][ 1 ];
+
+	if ( fields.length == 0 ) {
+
+		return tag + " " + ( timestamp / 1e6 ).toFixed( 6 );
+
+	}
+
+	var values = [];
+	var offset = 0;
+
+	for ( var i = 0; i < fields.length; i ++ ) {
+
+		var field = fields[ i ];
+
+		if ( field == "p" && quantized ) {
+
+			var decoded = decodePosition( payload, offset );
+
+			if ( decoded == null ) return null;
+
+			decoded.position.forEach( function ( v ) {
+
+				values.push( v.toFixed( 3 ) );
+
+			} );
+
+			offset += decoded.length;
+			continue;
+
+		}
+
+		// all other fields are one or more 4-byte values
+		var n = ( field == "q" && ! quantized ) ? 4 : ( field == "p" ) ? 3 : 1;
+
+		if ( offset + 4 * n > payload.length ) return null;
+
+		if ( field == "q" && quantized ) {
+
+			unpackQuaternion( payload.readUInt32LE( offset ) ).forEach( function ( v ) {
+
+				values.push( v.toFixed( 3 ) );
+
+			} );
+
+		} else if ( field == "i" ) {
+
+			values.push( payload.readInt32LE( offset ).toString() );
+
+		} else if ( field == "u" ) {
+
+			values.push( payload.readUInt32LE( offset ).toString() );
+
+		} else {
+
+			var decimals = ( field == "q" || field == "p" ) ? 3 : parseInt( field.substring( 1 ) );
+
+			for ( var j = 0; j < n; j ++ ) {
+
+				values.push( payload.readFloatLE( offset + 4 * j ).toFixed( decimals ) );
+
+			}
+
+		}
+
+		offset += 4 * n;
+
+	}
+
+	if ( offset != payload.length ) {
+
+		return null;
+
+	}
+
+	return tag + " " + values.join( " " );
+
+}
+
+// Converts the bytes between two 0 delimiters of the serial stream to a
+// message. Diagnostic text printed with Serial.print on the Teensy precedes
+// the next frame. 0x0A is a valid byte of an encoded frame, so the text ends
+// at the first newline after which the rest is a valid frame. The text is
+// printed. Returns null if there is no valid frame.
+function decodeSerialData( data ) {
+
+	var message = decodeTelemetryFrame( data );
+
+	for ( var newline = data.indexOf( 0x0A ); message == null && newline >= 0;
+		newline = data.indexOf( 0x0A, newline + 1 ) ) {
+
+		message = decodeTelemetryFrame( data.slice( newline + 1 ) );
+
+		if ( message != null ) {
+
+			console.log( data.slice( 0, newline ).toString( "ascii" ) );
+
+		}
+
+	}
+
+	return message;
+
+}
+
+// COBS encodes data, see cobsEncode() in Telemetry.cpp
+function cobsEncode( data ) {
+
+	var out = [ 0 ];
+	var codeIndex = 0;
+	var code = 1;
+
+	for ( var i = 0; i < data.length; i ++ ) {
+
+		if ( data[ i ] == 0 ) {
+
+			out[ codeIndex ] = code;
+			codeIndex = out.length;
+			out.push( 0 );
+			code = 1;
+
+		} else {
+
+			out.push( data[ i ] );
+			code ++;
+
+			if ( code == 0xFF ) {
+
+				out[ codeIndex ] = code;
+				codeIndex = out.length;
+				out.push( 0 );
+				code = 1;
+
+			}
+
+		}
+
+	}
+
+	out[ codeIndex ] = code;
+
+	return Buffer.from( out );
+
+}
+
+// Sends a command frame with the payload (a Buffer) to the Teensy
+function sendCommand( type, payload ) {
+
+	if ( openSerialPort == null ) return;
+
+	var frame = Buffer.alloc( payload.length + 4 );
+	frame[ 0 ] = TELEMETRY_VERSION;
+	frame[ 1 ] = type;
+	payload.copy( frame, 2 );
+	frame.writeUInt16LE( crc16( frame, frame.length - 2 ), frame.length - 2 );
+
+	openSerialPort.write( Buffer.concat( [ cobsEncode( frame ), Buffer.from( [ 0 ] ) ] ) );
+
+}
+
+// Converts a JSON command of the browser to a command frame
+function handleBrowserCommand( command ) {
+
+	if ( ! binaryTelemetry ) return;
+
+	if ( Array.isArray( command.subscribe ) ) {
+
+		var mask = 0;
+
+		command.subscribe.forEach( function ( tag ) {
+
+			var type = telemetryFormats.findIndex( function ( format ) {
+
+				return format[ 0 ] == tag;
+
+			} );
+
+			if ( type > 0 ) mask |= 1 << type;
+
+		} );
+
+		var payload = Buffer.alloc( 4 );
+		payload.writeUInt32LE( mask >>> 0, 0 );
+		sendCommand( CMD_SUBSCRIBE, payload );
+
+	}
+
+	if ( Array.isArray( command.rate ) && command.rate.length == 2 ) {
+
+		var ratePayload = Buffer.alloc( 5 );
+		ratePayload[ 0 ] = command.rate[ 0 ];
+		ratePayload.writeFloatLE( command.rate[ 1 ], 1 );
+		sendCommand( CMD_SET_RATE, ratePayload );
+
+	}
+
+	if ( command.config ) {
+
+		sendCommand( CMD_GET_CONFIG, Buffer.alloc( 0 ) );
+
+	}
+
+	if ( command.counters ) {
+
+		sendCommand( CMD_GET_COUNTERS, Buffer.alloc( 0 ) );
+
+	}
+
+}
+
 function setupSerialPort( portName ) {
 
-	// Instantiate SerialPort
-	const parser = new SerialPort.parsers.Readline();
+	// Instantiate SerialPort. Binary frames are terminated with a 0 byte
+	const parser = binaryTelemetry ?
+		new SerialPort.parsers.Delimiter( { delimiter: Buffer.from( [ 0 ] ) } ) :
+		new SerialPort.parsers.Readline();
 
 	const serialPort = new SerialPort( portName, {
 
@@ -141,12 +598,16 @@ function setupSerialPort( portName ) {
 
 		console.log( "The serial port to Teensy is opened." );
 
+		openSerialPort = serialPort;
+
 	} );
 
 	serialPort.on( "close", function () {
 
 		console.log( "The serial port to Teensy is closed." );
 
+		openSerialPort = null;
+
 		//try to reconnect in 1 s
 		setTimeout( findSerialPort, 1000 );
 
@@ -161,6 +622,20 @@ function setupSerialPort( portName ) {
 	// transmit serial port data though the web socket server
 	parser.on( "data", function ( data ) {
 
+		if ( binaryTelemetry ) {
+
+			data = decodeSerialData( data );
+
+			if ( data == null ) {
+
+				droppedFrames ++;
+				console.log( "Dropped invalid frame (" + droppedFrames + " in total)" );
+				return;
+
+			}
+
+		}
+
 		if ( printData ) {
 
 			console.log( data );
@@ -200,7 +675,22 @@ function setupSerialPort( portName ) {
 
 		}
 
-		serialPort.write( key );
+		if ( ! binaryTelemetry ) {
+
+			serialPort.write( key );
+			return;
+
+		}
+
+		// 'c' queries the configuration and the counters
+		if ( key === 'c' ) {
+
+			handleBrowserCommand( { config: true, counters: true } );
+			return;
+
+		}
+
+		sendCommand( CMD_KEY, Buffer.from( key, "utf8" ).slice( 0, 1 ) );
 
 	} );
 
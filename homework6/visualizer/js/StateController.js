@@ -146,9 +146,10 @@ function StateController() {
 			} else if ( dataArray[ 0 ] == 'PD' ) {
 
 				//record diode 2d positions. format is d0x, d0y, d1x, d1y, ...
+				//occluded diodes are nan
 				for ( var i = 0; i < 8; i ++ ) {
 
-					_this.diodeCoordinates[ i ] = dataArray[ i + 1 ];
+					_this.diodeCoordinates[ i ] = parseFloat( dataArray[ i + 1 ] );
 
 				}
 
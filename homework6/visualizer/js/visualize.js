@@ -98,9 +98,16 @@ function updatePose() {
 		scene.lighthouse.quaternion.copy( stateController.lighthouse.quaternion );
 		for ( var i = 0; i < 4; i ++ ) {
 
-			sceneDiodes.diodes[ i ].position.set(
-				stateController.diodeCoordinates[ 2 * i ],
-				stateController.diodeCoordinates[ 2 * i + 1 ], 0 );
+			var x = stateController.diodeCoordinates[ 2 * i ];
+			var y = stateController.diodeCoordinates[ 2 * i + 1 ];
+
+			//hide occluded diodes, keep their last position
+			sceneDiodes.diodes[ i ].visible = ! isNaN( x ) && ! isNaN( y );
+			if ( sceneDiodes.diodes[ i ].visible ) {
+
+				sceneDiodes.diodes[ i ].position.set( x, y, 0 );
+
+			}
 
 		}
 
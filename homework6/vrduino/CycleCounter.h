@@ -0,0 +1,65 @@
+/**
+ * @file
+ * measures the cost of code sections in CPU cycles with the cycle counter
+ * of the Cortex-M4 (DWT_CYCCNT). the counter wraps around after
+ * 2^32 cycles (about 60 s at 72 MHz), durations are computed modulo 2^32.
+ */
+
+#pragma once
+#include <Arduino.h>
+
+/**
+ * enables the cycle counter. it is off after reset.
+ */
+inline void enableCycleCounter() {
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+}
+
+/**
+ * @returns the current value of the cycle counter
+ */
+inline uint32_t getCycleCount() {
+  return ARM_DWT_CYCCNT;
+}
+
+/**
+ * running statistics of the cycles spent in a code section.
+ * usage:
+ *   uint32_t start = getCycleCount();
+ *   ...
+ *   stats.add(getCycleCount() - start);
+ */
+struct CycleStats {
+
+  /** sum of the cycles of all samples since the last reset */
+  uint32_t sum;
+
+  /** number of samples since the last reset */
+  uint32_t n;
+
+  /** maximum cycles of a sample since the last reset */
+  uint32_t max;
+
+  CycleStats() : sum(0), n(0), max(0) {}
+
+  /** adds the cycles of one sample */
+  void add(uint32_t cycles) {
+    sum += cycles;
+    n++;
+    if (cycles > max) {
+      max = cycles;
+    }
+  }
+
+  /** @returns average cycles per sample, 0 if there are none */
+  uint32_t average() const { return (n == 0) ? 0 : sum / n; }
+
+  /** starts a new measurement window */
+  void reset() {
+    sum = 0;
+    n = 0;
+    max = 0;
+  }
+
+};
@@ -0,0 +1,159 @@
+#include "GyroBiasModel.h"
+
+/** acc magnitude at rest in m/s^2 */
+static const double GRAVITY = 9.80665;
+
+GyroBiasModel::GyroBiasModel() :
+
+  bias{0, 0, 0},
+  temperature(NAN),
+  slope{0, 0, 0},
+  variance{DEFAULT_VARIANCE, DEFAULT_VARIANCE, DEFAULT_VARIANCE},
+  periodCount(0),
+  periodGyrSum{0, 0, 0},
+  periodGyrSquaredSum{0, 0, 0},
+  periodTemperatureSum(0),
+  fitWeight(0),
+  fitT(0),
+  fitTT(0),
+  fitB{0, 0, 0},
+  fitTB{0, 0, 0},
+  updates(0)
+
+  {
+
+}
+
+void GyroBiasModel::setBias(const double biasIn[3], double temperatureIn, int samples) {
+
+  fitWeight = 0;
+  fitT = 0;
+  fitTT = 0;
+  for (int i = 0; i < 3; i++) {
+    fitB[i] = 0;
+    fitTB[i] = 0;
+  }
+  periodCount = 0;
+  updates = 0;
+
+  if (isnan(temperatureIn)) {
+    for (int i = 0; i < 3; i++) {
+      bias[i] = biasIn[i];
+    }
+    temperature = NAN;
+    return;
+  }
+
+  addPoint(biasIn, temperatureIn, (double)samples / STATIONARY_SAMPLES);
+  updates = 0;
+
+}
+
+void GyroBiasModel::setVariance(const double varianceIn[3]) {
+
+  for (int i = 0; i < 3; i++) {
+    variance[i] = varianceIn[i];
+  }
+
+}
+
+void GyroBiasModel::setSlope(const double slopeIn[3]) {
+
+  for (int i = 0; i < 3; i++) {
+    slope[i] = slopeIn[i];
+  }
+
+}
+
+void GyroBiasModel::computeBias(double temperatureIn, double biasOut[3]) {
+
+  // the first sample after a bias of unknown temperature
+  if (isnan(temperature)) {
+    temperature = temperatureIn;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    biasOut[i] = bias[i] + slope[i] * (temperatureIn - temperature);
+  }
+
+}
+
+bool GyroBiasModel::addSample(const double gyr[3], const double acc[3], double temperatureIn) {
+
+  double biasNow[3];
+  computeBias(temperatureIn, biasNow);
+
+  double gyrDeviation = sqrt(sq(gyr[0] - biasNow[0]) + sq(gyr[1] - biasNow[1]) +
+    sq(gyr[2] - biasNow[2]));
+  double normA = sqrt(sq(acc[0]) + sq(acc[1]) + sq(acc[2]));
+
+  // the imu moves, start a new period
+  if (gyrDeviation > STATIONARY_GYR || fabs(normA - GRAVITY) > STATIONARY_ACC * GRAVITY) {
+    periodCount = 0;
+    return false;
+  }
+
+  if (periodCount == 0) {
+    periodGyrSum[0] = 0;
+    periodGyrSum[1] = 0;
+    periodGyrSum[2] = 0;
+    periodGyrSquaredSum[0] = 0;
+    periodGyrSquaredSum[1] = 0;
+    periodGyrSquaredSum[2] = 0;
+    periodTemperatureSum = 0;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    periodGyrSum[i] += gyr[i];
+    periodGyrSquaredSum[i] += sq(gyr[i]);
+  }
+  periodTemperatureSum += temperatureIn;
+  periodCount++;
+
+  if (periodCount < STATIONARY_SAMPLES) {
+    return false;
+  }
+
+  // the rate of a slow rotation changes over the period
+  double mean[3];
+  double meanTemperature = periodTemperatureSum / periodCount;
+  bool still = true;
+  for (int i = 0; i < 3; i++) {
+    mean[i] = periodGyrSum[i] / periodCount;
+    double periodVariance = periodGyrSquaredSum[i] / periodCount - sq(mean[i]);
+    still = still && periodVariance <= STATIONARY_SPREAD * variance[i];
+  }
+  periodCount = 0;
+  if (!still) {
+    return false;
+  }
+
+  addPoint(mean, meanTemperature, 1);
+  return true;
+
+}
+
+void GyroBiasModel::addPoint(const double gyr[3], double temperatureIn, double weight) {
+
+  fitWeight = FORGETTING * fitWeight + weight;
+  fitT = FORGETTING * fitT + weight * temperatureIn;
+  fitTT = FORGETTING * fitTT + weight * sq(temperatureIn);
+  for (int i = 0; i < 3; i++) {
+    fitB[i] = FORGETTING * fitB[i] + weight * gyr[i];
+    fitTB[i] = FORGETTING * fitTB[i] + weight * temperatureIn * gyr[i];
+  }
+
+  // the model is the fit around the weighted mean temperature
+  double meanT = fitT / fitWeight;
+  double varianceT = fitTT / fitWeight - sq(meanT);
+  for (int i = 0; i < 3; i++) {
+    double meanB = fitB[i] / fitWeight;
+    if (varianceT >= sq(MIN_TEMPERATURE_SPREAD)) {
+      slope[i] = (fitTB[i] / fitWeight - meanT * meanB) / varianceT;
+    }
+    bias[i] = meanB;
+  }
+  temperature = meanT;
+  updates++;
+
+}
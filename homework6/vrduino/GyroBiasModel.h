@@ -0,0 +1,153 @@
+/**
+ * @class GyroBiasModel
+ * model of the gyro bias as a linear function of the imu temperature, per
+ * axis:
+ *   bias(T) = bias + slope * (T - temperature)
+ * the bias drifts while the imu warms up. the model is learned from the
+ * mean gyro values of the periods in which the imu is stationary, so the
+ * bias does not have to be measured again.
+ *
+ * a period is stationary if, for STATIONARY_SAMPLES samples in a row, the
+ * gyro is within STATIONARY_GYR deg/s of the model and the acc within
+ * STATIONARY_ACC of 1 g, and the variance of the gyro around the mean of
+ * the period is at most STATIONARY_SPREAD times the variance of the noise
+ * at rest. a slow rotation stays within STATIONARY_GYR, but its rate
+ * changes over the period. the mean of a period is a point of a
+ * least-squares fit, weighted by its number of samples, in which older
+ * points are weighted less. the slope is only fitted once the
+ * temperatures of the points are spread by MIN_TEMPERATURE_SPREAD,
+ * otherwise only the bias is updated.
+ */
+
+#pragma once
+#include <Arduino.h>
+
+class GyroBiasModel {
+
+  public:
+
+    GyroBiasModel();
+
+
+    /**
+     * sets the bias, e.g. the one measured on start, and restarts the fit
+     * with it. the slope is kept
+     * @param [in] bias - gyro bias in deg/s, order is wx, wy, wz
+     * @param [in] temperature - temperature in deg C of the bias. NAN: it
+     *   is unknown, the temperature of the next sample is used, and the
+     *   bias is not a point of the fit
+     * @param [in] samples - number of samples averaged for the bias, its
+     *   weight in the fit. default: the samples of a stationary period
+     */
+    void setBias(const double bias[3], double temperature,
+      int samples = STATIONARY_SAMPLES);
+
+
+    /**
+     * sets the variance of the gyro noise at rest, e.g. the one measured
+     * with the bias on start. until it is set, DEFAULT_VARIANCE is used
+     * @param [in] variance - in (deg/s)^2, order is wx, wy, wz
+     */
+    void setVariance(const double variance[3]);
+
+
+    /**
+     * sets the change of the bias per deg C, e.g. from a previous fit
+     */
+    void setSlope(const double slope[3]);
+
+
+    /**
+     * computes the bias at a temperature
+     * @param [in] temperature - in deg C
+     * @param [out] biasOut - gyro bias in deg/s
+     */
+    void computeBias(double temperature, double biasOut[3]);
+
+
+    /**
+     * adds a sample, and updates the model at the end of a stationary period
+     * @param [in] gyr - gyro values in deg/s, without bias subtraction
+     * @param [in] acc - acc values in m/s^2
+     * @param [in] temperature - imu temperature in deg C
+     * @returns true if the model was updated
+     */
+    bool addSample(const double gyr[3], const double acc[3], double temperature);
+
+
+    /** @returns bias at getTemperature(), in deg/s */
+    const double* getBias() const { return bias; };
+
+
+    /** @returns temperature of getBias(), in deg C */
+    double getTemperature() const { return temperature; };
+
+
+    /** @returns change of the bias per deg C, in deg/s/C */
+    const double* getSlope() const { return slope; };
+
+
+    /** @returns number of stationary periods learned since setBias() */
+    unsigned long getUpdates() const { return updates; };
+
+
+  private:
+
+    /** samples of a stationary period */
+    static const int STATIONARY_SAMPLES = 500;
+
+    /** maximum deviation of the gyro from the model in deg/s */
+    static constexpr double STATIONARY_GYR = 1.0;
+
+    /** maximum relative deviation of the acc from 1 g */
+    static constexpr double STATIONARY_ACC = 0.03;
+
+    /** maximum ratio of the gyro variance of a period to the one at rest */
+    static constexpr double STATIONARY_SPREAD = 2.0;
+
+    /** variance of the gyro noise at rest if it is not set, in (deg/s)^2 */
+    static constexpr double DEFAULT_VARIANCE = 0.01;
+
+    /** weight of the previous points when a point is added */
+    static constexpr double FORGETTING = 0.95;
+
+    /** minimum standard deviation of the temperatures to fit the slope, in deg C */
+    static constexpr double MIN_TEMPERATURE_SPREAD = 1.0;
+
+    /**
+     * adds the mean of a stationary period to the fit, and updates the model
+     * @param [in] weight - number of samples of the mean, relative to
+     *   STATIONARY_SAMPLES
+     */
+    void addPoint(const double gyr[3], double temperatureIn, double weight);
+
+
+    /** bias at temperature, in deg/s */
+    double bias[3];
+
+    /** temperature of bias in deg C, NAN if unknown */
+    double temperature;
+
+    /** change of the bias per deg C */
+    double slope[3];
+
+    /** variance of the gyro noise at rest in (deg/s)^2 */
+    double variance[3];
+
+    /** sums of the current stationary period */
+    int periodCount;
+    double periodGyrSum[3];
+    double periodGyrSquaredSum[3];
+    double periodTemperatureSum;
+
+    /** weighted sums of the points of the fit: weights, T, T^2, bias, T * bias */
+    double fitWeight;
+    double fitT;
+    double fitTT;
+    double fitB[3];
+    double fitTB[3];
+
+    /** number of stationary periods learned */
+    unsigned long updates;
+
+};
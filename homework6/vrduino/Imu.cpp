@@ -139,6 +139,9 @@ int I2C_ClearBus() {
 void Imu::init()
 {
 
+  // the samples are timestamped with the FTM0 ticks, like the lighthouse
+  InputCapture::beginTimer();
+
   // Clearing the bus is necessary due to a common I2C problem: when restarting the program several times
   // in a row, soemtimes the slave (i.e., IMU) waits for a package by the master (Arduino) and keeps the
   // SDA line low. There is no way for the master to release it other than clearing the bus this way.
@@ -214,6 +217,7 @@ bool Imu::read() {
   if ((int_status & 0x01) == false ) {
     return false;
   }
+  timestamp = InputCapture::now();
 
   // all measurements are converted to 16 bits by the IMU-internal ADC
   double max16BitValue = 32767.0;
@@ -249,6 +253,13 @@ bool Imu::read() {
   accY = double(ay) * accScale;
   accZ = double(az) * accScale;
 
+  /////////////////////////////////////////////////////////////////////////////
+  // Read temperature
+
+  /* 16 bit temperature raw data, 333.87 per deg C, 0 at 21 deg C */
+  int16_t t = Buf[6] << 8 | Buf[7];
+  temperature = double(t) / 333.87 + 21.0;
+
   /////////////////////////////////////////////////////////////////////////////
   // Read gyroscope
 
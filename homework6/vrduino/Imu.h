@@ -14,6 +14,8 @@
 /* for I2C and serial communication */
 #include <Wire.h>
 
+#include "InputCapture.h"
+
 class Imu {
 public:
 
@@ -21,6 +23,13 @@ public:
   double accX, accY, accZ;
   double magX, magY, magZ;
 
+  // die temperature in deg C
+  double temperature;
+
+  // time when the data-ready flag of the sample was seen, before the
+  // data is transferred. in FTM0 ticks, see InputCapture::now()
+  uint64_t timestamp;
+
   /* initialize imu */
   void init();
 
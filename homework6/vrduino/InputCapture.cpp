@@ -98,7 +98,7 @@ void ftm0_isr(void)
 // some explanation regarding this C to C++ trickery can be found here:
 // http://forum.pjrc.com/threads/25278-Low-Power-with-Event-based-software-architecture-brainstorm?p=43496&viewfull=1#post43496
 
-uint16_t InputCapture::overflow_count = 0;
+volatile uint32_t InputCapture::overflow_count = 0;
 bool InputCapture::overflow_inc = false;
 volatile uint8_t InputCapture::channelmask = 0;
 InputCapture * InputCapture::list[8];
@@ -119,15 +119,7 @@ bool InputCapture::begin(uint8_t pin, int polarity)
 
 	cscEdge = (polarity == FALLING) ? 0b01001000 : 0b01000100;
 
-	if (FTM0_MOD != 0xFFFF || (FTM0_SC & 0x7F) != FTM0_SC_VALUE) {
-		FTM0_SC = 0;
-		FTM0_CNT = 0;
-		FTM0_MOD = 0xFFFF;
-		FTM0_SC = FTM0_SC_VALUE;
-		#if defined(KINETISK)
-		FTM0_MODE = 0;
-		#endif
-	}
+	beginTimer();
 
 	switch (pin) {
 	  case  6: channel = 4; reg = &FTM0_C4SC; break;
@@ -167,6 +159,60 @@ bool InputCapture::begin(uint8_t pin, int polarity)
 	return true;
 }
 
+/** starts FTM0 free running with the overflow interrupt.
+ *  the timestamps of IMU and lighthouse both use it.
+ */
+void InputCapture::beginTimer()
+{
+	if (FTM0_MOD != 0xFFFF || (FTM0_SC & 0x7F) != FTM0_SC_VALUE) {
+		FTM0_SC = 0;
+		FTM0_CNT = 0;
+		FTM0_MOD = 0xFFFF;
+		FTM0_SC = FTM0_SC_VALUE;
+		#if defined(KINETISK)
+		FTM0_MODE = 0;
+		#endif
+	}
+
+	NVIC_SET_PRIORITY(IRQ_FTM0, 32);
+	NVIC_ENABLE_IRQ(IRQ_FTM0);
+}
+
+/** reads the overflow count and the counter consistently.
+ *  works with interrupts disabled, as long as they are not disabled
+ *  for more than one overflow period (~1.4 ms).
+ */
+uint64_t InputCapture::now()
+{
+	uint32_t count;
+	uint32_t cnt;
+	bool pending;
+
+	// retry if the ISR counted an overflow in between
+	do {
+		count = overflow_count;
+		cnt = FTM0_CNT;
+		pending = FTM0_SC & 0x80;
+	} while (count != overflow_count);
+
+	// the overflow flag is set, but the ISR has not run yet
+	if (pending && cnt < 0x8000)
+		count++;
+
+	return ((uint64_t)count << 16) | cnt;
+}
+
+uint64_t InputCapture::extendTicks(uint32_t ticks)
+{
+	uint64_t t = now();
+	return t - (uint32_t)((uint32_t)t - ticks);
+}
+
+double InputCapture::ticksToSeconds(uint64_t ticks)
+{
+	return ticks / (CLOCKS_PER_MICROSECOND * 1000000.0);
+}
+
 /** ISR that runs during an edge interrupt.
     Records time when edge transition occurred.
  */
@@ -57,6 +57,21 @@ public:
   //call back to further process pulse time
   virtual void callback(uint32_t value);
 
+  // starts FTM0 and its overflow interrupt, if not running yet.
+  // called by begin(), call it before now() if no pin is captured
+  static void beginTimer();
+
+  // monotonic time in FTM0 ticks (F_BUS), 64 bit. the low 32 bits are
+  // the ticks passed to callback()
+  static uint64_t now();
+
+  // extends ticks passed to callback() to 64 bit. the ticks must be
+  // less than 2^32 ticks (~89 s) old
+  static uint64_t extendTicks(uint32_t ticks);
+
+  // converts FTM0 ticks to seconds
+  static double ticksToSeconds(uint64_t ticks);
+
   friend void ftm0_isr(void);
 
 private:
@@ -69,7 +84,7 @@ private:
   uint8_t cscEdge;
 
   // track which channels we have installed
-  static uint16_t overflow_count;
+  static volatile uint32_t overflow_count;
   static volatile uint8_t channelmask;
   static bool overflow_inc;
   static InputCapture *list[8];
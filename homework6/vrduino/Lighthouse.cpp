@@ -26,7 +26,8 @@ Lighthouse::Lighthouse() :
 
 
 bool Lighthouse::readTimings(int baseStationMode, unsigned long values[8], unsigned long numPulseDetections[8],
-  unsigned long pulseWidth[8], double &pitch, double &roll) {
+  unsigned long pulseWidth[8], unsigned long pulseDifference[8], double &pitch, double &roll,
+  uint64_t &timestamp) {
 
   //disable interrupts so that pulses aren't updated in between reads
   __disable_irq();
@@ -48,10 +49,12 @@ bool Lighthouse::readTimings(int baseStationMode, unsigned long values[8], unsig
       values[i] = pulseData.station[pid].sweepPulseTicks[i];
       numPulseDetections[i] = pulseData.station[pid].numPulseDetections[i];
       pulseWidth[i] = pulseData.station[pid].sweepPulseWidth[i];
+      pulseDifference[i] = pulseData.station[pid].sweepPulseDifference[i];
     }
 
     pitch = pulseData.station[pid].pitch;
     roll = pulseData.station[pid].roll;
+    timestamp = InputCapture::extendTicks(pulseData.station[pid].sweepSyncTicks);
 
     //we have read, so set dataAvailable to false
     //to prevent multiple reads of the same values
@@ -64,3 +67,115 @@ bool Lighthouse::readTimings(int baseStationMode, unsigned long values[8], unsig
   return success;
 
 }
+
+
+void Lighthouse::processOOTX() {
+
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].ootx.processBits()) {
+
+      //the ISR does not read the base station info, only readTimings does
+      __disable_irq();
+      pulseData.station[i].ootx.getBaseStationInfo(
+        pulseData.station[i].pitch,
+        pulseData.station[i].roll,
+        pulseData.station[i].mode
+      );
+      __enable_irq();
+
+    }
+  }
+
+}
+
+
+double Lighthouse::getRotorPeriod(int baseStationMode) {
+
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].mode == baseStationMode) {
+      //the rotor period is twice the sync period. 32 bit reads are atomic
+      return 2.0 * pulseData.station[i].syncPeriodTicks16 / 16.0;
+    }
+  }
+
+  return 0;
+
+}
+
+
+bool Lighthouse::isOOTXInfoAvailable(int baseStationMode) {
+
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].mode == baseStationMode) {
+      return pulseData.station[i].ootx.isOOTXInfoAvailable();
+    }
+  }
+
+  return false;
+
+}
+
+
+bool Lighthouse::getCalibration(int baseStationMode, BaseStationCalibration &calibration) {
+
+  //the OOTX frames are decoded in the main loop, no need to disable interrupts
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].mode == baseStationMode) {
+      calibration = pulseData.station[i].ootx.getCalibration();
+      return true;
+    }
+  }
+
+  return false;
+
+}
+
+
+bool Lighthouse::setSweepWindows(int baseStationMode, unsigned long windowStart[8],
+  unsigned long windowWidth[8]) {
+
+  bool success = false;
+
+  __disable_irq();
+
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].mode == baseStationMode) {
+
+      for (int j = 0; j < 8; j++) {
+        pulseData.station[i].sweepWindowStart[j] = windowStart[j];
+        pulseData.station[i].sweepWindowWidth[j] = windowWidth[j];
+      }
+      pulseData.station[i].sweepGateEnabled = true;
+      success = true;
+
+    }
+  }
+
+  __enable_irq();
+
+  return success;
+
+}
+
+
+void Lighthouse::clearSweepWindows(int baseStationMode) {
+
+  __disable_irq();
+
+  for (int i = 0; i < 2; i++) {
+    if (pulseData.station[i].mode == baseStationMode) {
+
+      //center the windows on the last selected pulses
+      for (int j = 0; j < 8; j++) {
+        pulseData.station[i].sweepWindowStart[j] =
+          pulseData.station[i].sweepPulseTicks[j] - 0x7FFFFFFF;
+        pulseData.station[i].sweepWindowWidth[j] = 0xFFFFFFFF;
+      }
+      pulseData.station[i].sweepGateEnabled = false;
+
+    }
+  }
+
+  __enable_irq();
+
+}
@@ -31,12 +31,82 @@ class Lighthouse {
      * @param [in,out] numPulseDetections - number of sweep pulses detected. for debugging
      *   purposes. can be used to detect interreflections
      * @param [in,out] pulseWidth - the pulse widths of the sweep pulses. for debugging
+     * @param [in,out] pulseDifference - ticks between the selected sweep pulse and the
+     *   pulse of the previous period. large values indicate a reflection
+     * @param [out] timestamp - start of the sync pulse of the latest sweep, in
+     *   FTM0 ticks (see InputCapture::now())
      * @returns true if new data is available from the base station that matches the input mode,
      *  false if data is not available
      *
      */
     bool readTimings(int baseStationMode, unsigned long values[8], unsigned long numPulseDetections[8],
-      unsigned long pulseWidth[8], double &pitch, double &roll);
+      unsigned long pulseWidth[8], unsigned long pulseDifference[8], double &pitch, double &roll,
+      uint64_t &timestamp);
+
+    /**
+     * decodes the OOTX data bits queued by the ISR, and updates the pitch,
+     * roll and mode of the base stations once a frame is complete.
+     * call regularly from the main loop, at least every two seconds.
+     */
+    void processOOTX();
+
+    /**
+     * true while the sync pulses are assigned to the stations by their
+     * predicted cadence, see LighthouseInputCapture::getSyncStationIndex()
+     */
+    bool isSyncLocked() const { return pulseData.syncLocked; }
+
+    /** number of times the sync lock was (re)acquired */
+    unsigned long getSyncResyncs() const { return pulseData.syncResyncs; }
+
+    /** total number of predicted sync pulses that were not seen */
+    unsigned long getSyncMissed() const { return pulseData.syncMissedTotal; }
+
+    /** number of sync pulses that did not match a prediction and were ignored */
+    unsigned long getSyncRejected() const { return pulseData.syncRejected; }
+
+    /**
+     * measured period of one rotor revolution of the base station with the given
+     * mode, in clock ticks. this is nominally CLOCKS_PER_SECOND / 60, but both the
+     * rotor speed and the clock of the Teensy drift.
+     * @param [in] baseStationMode - mode of the base station (0:A, 1:B, 2:C)
+     * @returns the period, or 0 if it was not measured yet
+     */
+    double getRotorPeriod(int baseStationMode);
+
+    /**
+     * @param [in] baseStationMode - mode of the base station (0:A, 1:B, 2:C)
+     * @returns true once an OOTX frame of the base station with the given mode
+     *   was decoded, i.e. its pitch and roll are known
+     */
+    bool isOOTXInfoAvailable(int baseStationMode);
+
+    /**
+     * gets the factory calibration of the base station with the given mode
+     * @param [in] baseStationMode - mode of the base station (0:A, 1:B, 2:C)
+     * @param [out] calibration - calibration from the OOTX frame. calibration.valid
+     *   is false if it is not known yet
+     * @returns false if no station with this mode has been seen
+     */
+    bool getCalibration(int baseStationMode, BaseStationCalibration &calibration);
+
+    /**
+     * sets the windows of expected sweep ticks for the base station with the
+     * given mode. the ISR ignores sweep pulses outside of the windows.
+     * @param [in] baseStationMode - mode of the base station (0:A, 1:B, 2:C)
+     * @param [in] windowStart - first accepted tick for each diode axis
+     * @param [in] windowWidth - width of the windows in ticks
+     * @returns false if no station with this mode has been seen
+     */
+    bool setSweepWindows(int baseStationMode, unsigned long windowStart[8],
+      unsigned long windowWidth[8]);
+
+    /**
+     * stops gating sweep pulses of the base station with the given mode.
+     * all pulses are accepted and the one closest to the previous period is selected.
+     * @param [in] baseStationMode - mode of the base station (0:A, 1:B, 2:C)
+     */
+    void clearSweepWindows(int baseStationMode);
 
   private:
 
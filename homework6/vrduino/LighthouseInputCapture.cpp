@@ -62,18 +62,31 @@ void LighthouseInputCapture::callback(uint32_t value) {
     //axis=0: Horizontal, axis=1: Vertical
     uint32_t sweepTicks = fallingEdgeTicks - pulseData->lastValidSyncPulseTicks;
 
+    //the sync pulse of this period was missed
+    if (sweepTicks >= SYNC_PERIOD_TICKS) {
+      return;
+    }
+
     int index = 2*sensorIndex + pulseData->station[pid].axis;
 
+    //ignore pulses outside the window of expected ticks. the subtraction
+    //wraps around for pulses before the window, so one compare is enough.
+    uint32_t windowWidth = pulseData->station[pid].sweepWindowWidth[index];
+    uint32_t windowOffset = sweepTicks - pulseData->station[pid].sweepWindowStart[index];
+    if (windowOffset > windowWidth) {
+      return;
+    }
+
     pulseData->station[pid].numPulseDetectionsTemp[index]++;
 
-    //we could still have multiple sweep pulses in a period
-    //get difference from previous pulse position,
+    //we could still have multiple sweep pulses in the window
+    //get difference from the center of the window,
     // and choose the pulse with smallest difference
-    long pulseDiff = labs((long long)sweepTicks -
-      (long long)pulseData->station[pid].sweepPulseTicks[index]);
+    int32_t centerOffset = (int32_t)(windowOffset - (windowWidth >> 1));
+    uint32_t pulseDiff = (centerOffset < 0) ? -centerOffset : centerOffset;
 
     if (pulseData->station[pid].numPulseDetectionsTemp[index] == 1 ||
-      pulseDiff < (long)pulseData->station[pid].minPulseDifferences[index]) {
+      pulseDiff < pulseData->station[pid].minPulseDifferences[index]) {
 
       pulseData->station[pid].sweepPulseTicksTemp[index] = sweepTicks;
       pulseData->station[pid].sweepPulseWidthTemp[index] = pulseLengthTicks;
@@ -84,16 +97,22 @@ void LighthouseInputCapture::callback(uint32_t value) {
   } else if (pulseType == 1 ) {
   // this is a sync pulse
 
-    //During a sync pulses, we decode base station info,
+    //During a sync pulses, we queue the base station info bit,
     //and update the sweepPulseTicks buffer.
     //the numPulseDetections and pulseWidth are just for debugging purposes
     //numPulseDetections specifies how many sweep pulses were seen.
     //pulseWidth specifies the length of the pulse in clock ticks
 
-    //All diodes will run this interrupt,
-    //but we only want sensor0 to update everything.
-    if (sensorIndex != 0) {
-      return;
+    //All diodes will run this interrupt, but we only want the first
+    //diode that sees the sync pulse to update everything, so that
+    //tracking continues if any of them is covered.
+    //the falling edges of all diodes are within a few us, but the
+    //rising edges are not in order, hence compare the distance.
+    if (pulseData->lastAnySyncPulseTicks > 0) {
+      int32_t syncOffset = (int32_t)(fallingEdgeTicks - pulseData->lastAnySyncPulseTicks);
+      if (syncOffset < SYNC_DEDUP_TICKS && syncOffset > -SYNC_DEDUP_TICKS) {
+        return;
+      }
     }
 
     //add databit to ootx frame. we keep track of 2 frames X,Y in case there
@@ -103,23 +122,20 @@ void LighthouseInputCapture::callback(uint32_t value) {
     //t_HY - t_HX =  20000 ticks
     //t_VX - t_HY = 380000 ticks
 
-    //use the time since the last sync pulse to decode whether pid=0 or 1
-    int pid = 0;
-    if (pulseData->lastAnySyncPulseTicks > 0) {
-
-      uint32_t sweepPulsePeriod = fallingEdgeTicks -
-        pulseData->lastAnySyncPulseTicks;
-
-      pid = (sweepPulsePeriod >= 40000) ? 0 : 1;
+    //use the predicted syncs, or the time since the last sync pulse
+    //to decode whether pid=0 or 1
+    bool firstSync = pulseData->lastAnySyncPulseTicks == 0;
+    int pid = getSyncStationIndex(fallingEdgeTicks);
 
-      pulseData->station[pid].ootx.addBit(dataBit);
-
-      pulseData->station[pid].ootx.getBaseStationInfo(
-        pulseData->station[pid].pitch,
-        pulseData->station[pid].roll,
-        pulseData->station[pid].mode
-      );
+    if (pid < 0) {
+      //spurious sync pulse, keep the record for deduplication only
+      pulseData->lastAnySyncPulseTicks = fallingEdgeTicks;
+      return;
+    }
 
+    if (!firstSync) {
+      //only queue the bit, the frame is decoded in the main loop
+      pulseData->station[pid].ootx.pushBit(dataBit);
     }
 
 
@@ -134,9 +150,19 @@ void LighthouseInputCapture::callback(uint32_t value) {
         pulseData->station[pid].sweepPulseTicks[j] = pulseData->station[pid].sweepPulseTicksTemp[j];
         pulseData->station[pid].sweepPulseWidth[j] = pulseData->station[pid].sweepPulseWidthTemp[j];
         pulseData->station[pid].numPulseDetections[j] = pulseData->station[pid].numPulseDetectionsTemp[j];
+        pulseData->station[pid].sweepPulseDifference[j] = pulseData->station[pid].minPulseDifferences[j];
+
+        //without a prediction, accept all ticks and select the pulse
+        //closest to the one of the period that just finished
+        if (!pulseData->station[pid].sweepGateEnabled) {
+          pulseData->station[pid].sweepWindowStart[j] =
+            pulseData->station[pid].sweepPulseTicksTemp[j] - 0x7FFFFFFF;
+          pulseData->station[pid].sweepWindowWidth[j] = 0xFFFFFFFF;
+        }
 
       }
 
+      pulseData->station[pid].sweepSyncTicks = pulseData->station[pid].sweepSyncTicksTemp;
       pulseData->station[pid].dataAvailable = true;
 
     }
@@ -155,6 +181,7 @@ void LighthouseInputCapture::callback(uint32_t value) {
       }
 
       pulseData->lastValidSyncPulseTicks = fallingEdgeTicks;
+      pulseData->station[pid].sweepSyncTicksTemp = fallingEdgeTicks;
       pulseData->currentIndex = pid;
 
     }
@@ -169,6 +196,150 @@ void LighthouseInputCapture::callback(uint32_t value) {
 
 }
 
+int LighthouseInputCapture::getSyncStationIndex(uint32_t syncTicks) {
+
+  PulseData::Station *station = pulseData->station;
+
+  if (pulseData->syncLocked) {
+
+    //coast through the syncs that were not seen since the last one
+    for (int i = 0; i < 2; i++) {
+      while (station[i].syncActive && station[i].missedSyncs <= SYNC_MAX_MISSED &&
+        (int32_t)(syncTicks - station[i].nextSyncPulseTicks) > SYNC_LOCK_TOLERANCE_TICKS) {
+        station[i].nextSyncPulseTicks += getSyncPeriod(i);
+        station[i].missedSyncs++;
+        pulseData->syncMissedTotal++;
+        //the sweeps since the last sync belong to the missed period
+        station[i].skip = true;
+      }
+    }
+
+    //a station that is not seen anymore keeps its slot, so the stations
+    //are not swapped while the other one is visible
+    for (int i = 0; i < 2; i++) {
+      if (station[i].missedSyncs > SYNC_MAX_MISSED) {
+        station[i].syncActive = false;
+        station[i].missedSyncs = 0;
+      }
+    }
+
+    if (!station[0].syncActive && !station[1].syncActive) {
+
+      //lost the lock, acquire it again below
+      pulseData->syncLocked = false;
+
+    } else {
+
+      for (int i = 0; i < 2; i++) {
+        int32_t offset = (int32_t)(syncTicks - station[i].nextSyncPulseTicks);
+        if (station[i].syncActive &&
+          offset >= -SYNC_LOCK_TOLERANCE_TICKS && offset <= SYNC_LOCK_TOLERANCE_TICKS) {
+          station[i].nextSyncPulseTicks = syncTicks + getSyncPeriod(i);
+          station[i].missedSyncs = 0;
+          updateSyncPeriod(i, syncTicks);
+          return i;
+        }
+      }
+
+      //the other station can (re)appear at either side of the visible one
+      int active = station[0].syncActive ? 0 : 1;
+      int other = 1 - active;
+      if (!station[other].syncActive) {
+        uint32_t lastSync = station[active].nextSyncPulseTicks - getSyncPeriod(active);
+        int32_t offsetAfter = (int32_t)(syncTicks - (lastSync + SYNC_STATION_OFFSET_TICKS));
+        int32_t offsetBefore = (int32_t)(syncTicks -
+          (lastSync + SYNC_PERIOD_TICKS - SYNC_STATION_OFFSET_TICKS));
+        if ((offsetAfter >= -SYNC_LOCK_TOLERANCE_TICKS && offsetAfter <= SYNC_LOCK_TOLERANCE_TICKS) ||
+          (offsetBefore >= -SYNC_LOCK_TOLERANCE_TICKS && offsetBefore <= SYNC_LOCK_TOLERANCE_TICKS)) {
+          station[other].nextSyncPulseTicks = syncTicks + getSyncPeriod(other);
+          station[other].syncActive = true;
+          station[other].missedSyncs = 0;
+          station[other].lastSyncPulseTicks = syncTicks;
+          return other;
+        }
+      }
+
+      pulseData->syncRejected++;
+      return -1;
+
+    }
+  }
+
+  if (pulseData->lastAnySyncPulseTicks == 0) {
+    return 0;
+  }
+
+  //not locked: the first station is the one after the long gap
+  uint32_t sweepPulsePeriod = syncTicks - pulseData->lastAnySyncPulseTicks;
+  int pid = (sweepPulsePeriod >= 2 * SYNC_STATION_OFFSET_TICKS) ? 0 : 1;
+
+  //lock if the time since the last sync matches the cadence
+  int32_t offsetPeriod = (int32_t)(sweepPulsePeriod - SYNC_PERIOD_TICKS);
+  int32_t offsetStation = (int32_t)(sweepPulsePeriod - SYNC_STATION_OFFSET_TICKS);
+  int32_t offsetPair = (int32_t)(sweepPulsePeriod - (SYNC_PERIOD_TICKS - SYNC_STATION_OFFSET_TICKS));
+
+  bool single = offsetPeriod >= -SYNC_LOCK_TOLERANCE_TICKS && offsetPeriod <= SYNC_LOCK_TOLERANCE_TICKS;
+  bool pair = (offsetStation >= -SYNC_LOCK_TOLERANCE_TICKS && offsetStation <= SYNC_LOCK_TOLERANCE_TICKS) ||
+    (offsetPair >= -SYNC_LOCK_TOLERANCE_TICKS && offsetPair <= SYNC_LOCK_TOLERANCE_TICKS);
+
+  if (single || pair) {
+
+    station[pid].nextSyncPulseTicks = syncTicks + getSyncPeriod(pid);
+    station[pid].syncActive = true;
+    station[pid].missedSyncs = 0;
+    station[pid].lastSyncPulseTicks = syncTicks;
+
+    //the previous sync was the other station
+    station[1 - pid].nextSyncPulseTicks = pulseData->lastAnySyncPulseTicks + getSyncPeriod(1 - pid);
+    station[1 - pid].syncActive = pair;
+    station[1 - pid].missedSyncs = 0;
+    station[1 - pid].lastSyncPulseTicks = pulseData->lastAnySyncPulseTicks;
+
+    pulseData->syncLocked = true;
+    pulseData->syncResyncs++;
+
+  }
+
+  return pid;
+
+}
+
+void LighthouseInputCapture::updateSyncPeriod(int pid, uint32_t syncTicks) {
+
+  PulseData::Station &station = pulseData->station[pid];
+
+  uint32_t interval = syncTicks - station.lastSyncPulseTicks;
+  station.lastSyncPulseTicks = syncTicks;
+
+  //number of periods since the previous sync, if some were missed
+  uint32_t nPeriods = (interval + SYNC_PERIOD_TICKS / 2) / SYNC_PERIOD_TICKS;
+  if (nPeriods == 0 || nPeriods > SYNC_MAX_MISSED + 1) {
+    return;
+  }
+
+  uint32_t period = interval / nPeriods;
+  int32_t periodError = (int32_t)(period - SYNC_PERIOD_TICKS);
+  if (periodError < -SYNC_PERIOD_TOLERANCE_TICKS || periodError > SYNC_PERIOD_TOLERANCE_TICKS) {
+    return;
+  }
+
+  //first order low-pass in fixed point, time constant of 16 periods
+  if (station.syncPeriodTicks16 == 0) {
+    station.syncPeriodTicks16 = period << 4;
+  } else {
+    int32_t delta = (int32_t)((period << 4) - station.syncPeriodTicks16);
+    station.syncPeriodTicks16 += delta >> 4;
+  }
+
+}
+
+uint32_t LighthouseInputCapture::getSyncPeriod(int pid) {
+
+  uint32_t period16 = pulseData->station[pid].syncPeriodTicks16;
+  return (period16 == 0) ? SYNC_PERIOD_TICKS : (period16 + 8) >> 4;
+
+}
+
 /**
  *  decodes the pulse length.
  *  also writes skip, data, and axis bit
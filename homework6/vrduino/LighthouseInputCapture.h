@@ -11,16 +11,22 @@
  *  it is a sweep or sync pulse.
  *
  *  If it is a sync pulse:
+ *    - only the first diode that sees the sync pulse processes it. the others are
+ *      ignored if their pulse starts within SYNC_DEDUP_TICKS of it.
  *    - record sweep pulse timing data of the previous period into permanent buffers
  *     for read-out. reset temp buffers to be updated this period.
- *    - record additional info such as base station pitch and roll encoded in the pulse length.
+ *    - queue the data bit encoded in the pulse length (base station pitch, roll, mode...).
+ *      the OOTX frame is decoded in the main loop, see Lighthouse::processOOTX().
  *      see: https: *github.com/nairol/LighthouseRedox/blob/master/docs/Light%20Emissions.md
  *    - data is recorded into the pulseData struct. see that struct for info on the fields
  *
  *  If it is a sweep pulse:
+ *    - ignore the pulse if it is outside the window of expected ticks. the window is
+ *      predicted from the last pose by the pose tracker, or spans all ticks otherwise.
  *    - record pulse timing data into temp buffers
  *    - interreflections could cause multiple sweep pulses within the same period.
- *     choose the pulse that is closest in timing to the pulse from the previous period.
+ *     choose the pulse that is closest to the center of the window, i.e. the predicted
+ *     pulse, or the pulse from the previous period if there is no prediction.
  *     the simplest solution would be to choose the first pulse and ignore the rest,
  *     but the adaptive solution seems to work better.
  *
@@ -71,6 +77,11 @@
  * determine if it's from station 0, station 1. The station mode cannot
  * be used to determine the identity, as this information is only available
  * after a full frame of databits has been transmitted through the sync pulse.
+ * Once the offset matches this cadence, the next sync pulse of each station is
+ * predicted and sync pulses are assigned by the prediction (lock). Syncs that
+ * match no prediction are ignored, and missing syncs are coasted through, so
+ * a single missed or spurious sync does not swap the stations.
+ * See getSyncStationIndex().
  * During a sync pulse from station i, the info from the previous pulse of
  * station i, is transmitted to permanent read-out buffers in pulseData.station[i]
  *
@@ -94,6 +105,27 @@
 #endif
 #endif
 
+/**
+ * sync pulses seen by several diodes start within this many ticks of each other.
+ * the syncs of two base stations are 20000 ticks apart.
+ */
+#define SYNC_DEDUP_TICKS ((int32_t)(50 * CLOCKS_PER_MICROSECOND))
+
+/** ticks between two sync pulses of the same base station (120 Hz) */
+#define SYNC_PERIOD_TICKS (CLOCKS_PER_MICROSECOND * 1000000 / 120)
+
+/** ticks between the sync pulses of two base stations */
+#define SYNC_STATION_OFFSET_TICKS (CLOCKS_PER_MICROSECOND * 1000000 / 2400)
+
+/** a sync pulse within this many ticks of a prediction is assigned to its station */
+#define SYNC_LOCK_TOLERANCE_TICKS ((int32_t)(50 * CLOCKS_PER_MICROSECOND))
+
+/** number of consecutive missing sync pulses of a station before its lock is lost */
+#define SYNC_MAX_MISSED 12
+
+/** measured sync periods further than this from SYNC_PERIOD_TICKS are ignored (1%) */
+#define SYNC_PERIOD_TOLERANCE_TICKS ((int32_t)(SYNC_PERIOD_TICKS / 100))
+
 class LighthouseInputCapture : public InputCapture {
 
   public:
@@ -137,4 +169,35 @@ class LighthouseInputCapture : public InputCapture {
      */
     int decodePulseLength(float pulseLength, bool  &skipBit, bool &dataBit, bool &axisBit);
 
+    /**
+     * assigns a sync pulse to a base station.
+     * while locked, the sync pulse is matched against the predicted sync of
+     * each station, predictions of missed syncs are advanced by one period, and
+     * the data of their period is dropped. a station that misses SYNC_MAX_MISSED
+     * syncs in a row is inactive, but keeps its index: while the other station is
+     * seen, it is locked again at SYNC_STATION_OFFSET_TICKS from that one, at either
+     * side. the lock is lost if both stations are inactive.
+     * while not locked, the station is determined by the time since the last sync,
+     * and the lock is acquired if that time matches the cadence of the stations.
+     * @param [in] syncTicks - timer value at the start of the sync pulse
+     * @returns index of the station (0 or 1), or -1 if the sync pulse matches
+     *   no prediction and should be ignored
+     */
+    int getSyncStationIndex(uint32_t syncTicks);
+
+    /**
+     * measures the sync period of a station from the time since its previous sync
+     * pulse, divided by the number of periods in between, and low-pass filters it.
+     * only called while locked, so the two stations are not mixed up.
+     * @param [in] pid - index of the station
+     * @param [in] syncTicks - timer value at the start of the sync pulse
+     */
+    void updateSyncPeriod(int pid, uint32_t syncTicks);
+
+    /**
+     * measured sync period of a station in ticks, or SYNC_PERIOD_TICKS if
+     * not measured yet
+     */
+    uint32_t getSyncPeriod(int pid);
+
 };
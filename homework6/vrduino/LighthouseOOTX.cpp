@@ -18,6 +18,10 @@
 ////////////////////////////////////////////////////////////////////////////////////////////
 #include "LighthouseOOTX.h"
 
+unsigned long LighthouseOOTX::cachedIDs[LighthouseOOTX::calibrationCacheSize];
+BaseStationCalibration LighthouseOOTX::cachedCalibrations[LighthouseOOTX::calibrationCacheSize];
+int LighthouseOOTX::nCachedCalibrations = 0;
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 // constructor - reset all variables
 
@@ -25,7 +29,14 @@ LighthouseOOTX::LighthouseOOTX() {
   reset();
   complete      = 0;
   length        = 0;
+  payloadLength = 0;
+  crcErrors     = 0;
+  baseStationID = 0;
+  calibration   = BaseStationCalibration();
   bCompleteOnce = false;
+  bitHead       = 0;
+  bitTail       = 0;
+  bitOverflow   = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,6 +50,64 @@ void LighthouseOOTX::reset() {
   rx_bytes              = 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////
+// queue a detected databit. called from the ISR, so only store the bit
+
+void LighthouseOOTX::pushBit(bool bit) {
+
+  uint16_t head = bitHead;
+  uint16_t next = (head + 1) & (bitBufferSize - 1);
+
+  if (next == bitTail) {
+    bitOverflow = true;
+    return;
+  }
+
+  uint32_t mask = 1UL << (head & 31);
+  if (bit) {
+    bitBuffer[head >> 5] |= mask;
+  } else {
+    bitBuffer[head >> 5] &= ~mask;
+  }
+
+  // publish the bit only after it was written
+  bitHead = next;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// decode the queued databits. called from the main loop
+
+bool LighthouseOOTX::processBits() {
+
+  // a dropped bit corrupts the current frame, start again
+  if (bitOverflow) {
+    bitTail = bitHead;
+    bitOverflow = false;
+    reset();
+    return false;
+  }
+
+  bool completed = false;
+
+  uint16_t head = bitHead;
+  uint16_t tail = bitTail;
+
+  while (tail != head) {
+    unsigned long bit = (bitBuffer[tail >> 5] >> (tail & 31)) & 1;
+    tail = (tail + 1) & (bitBufferSize - 1);
+
+    complete = 0;
+    addBit(bit);
+    if (complete) {
+      completed = true;
+    }
+  }
+
+  bitTail = tail;
+
+  return completed;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 // add a detected databit to the sequence
 
@@ -122,6 +191,7 @@ void LighthouseOOTX::add_word(unsigned long word) {
     // let's flip the order so that
     word = flipByteOrder(word);
 
+    payloadLength = word;
     length = word + 4; // add in the CRC32 length
     padding = length & 1;
     waiting_for_length = 0;
@@ -131,7 +201,9 @@ void LighthouseOOTX::add_word(unsigned long word) {
     if (length > sizeof(bytes)) {
       Serial.print("WARNING: length of payload seems questionable: ");
       Serial.println(word);
-      length = 33; // just set it to 33 by default
+      payloadLength = 33;
+      length = 33 + 4; // just set it to 33 by default
+      padding = 1;
       //reset();
     }
 
@@ -141,11 +213,34 @@ void LighthouseOOTX::add_word(unsigned long word) {
   bytes[rx_bytes++] = (word >> 8) & 0xFF;
   bytes[rx_bytes++] = (word >> 0) & 0xFF;
 
+  // bytes 3-6 are the unique identifier. if the base station was seen before,
+  // use its calibration right away instead of waiting for the end of the frame
+  if (rx_bytes == 6) {
+    lookUpCalibration();
+  }
+
   if (rx_bytes < length + padding)
     return;
 
   // we are at the end!
 
+  // the CRC32 follows the payload and the padding byte, little endian
+  unsigned crcOffset = payloadLength + (payloadLength & 1);
+  unsigned long crc = (unsigned long)bytes[crcOffset] |
+    ((unsigned long)bytes[crcOffset + 1] << 8) |
+    ((unsigned long)bytes[crcOffset + 2] << 16) |
+    ((unsigned long)bytes[crcOffset + 3] << 24);
+
+  if (payloadLength < 33 || crc32(bytes, payloadLength) != crc) {
+    // corrupt frame, keep the info of the previous one
+    crcErrors++;
+    waiting_for_length = 1;
+    reset();
+    return;
+  }
+
+  parseCalibration();
+
   // save base station pitch and roll from bytes 20 and 22
   //accelerometer acc axis: z points back, y is normal to top face
   double accx = double(int8_t(bytes[20]))/127.0;
@@ -174,6 +269,101 @@ void LighthouseOOTX::add_word(unsigned long word) {
   reset();
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// CRC32 with the reflected polynomial 0xEDB88320, initial value and final xor 0xFFFFFFFF.
+// bitwise instead of table based: it runs once per frame, in the main loop
+
+unsigned long LighthouseOOTX::crc32(const unsigned char *data, unsigned n) {
+  unsigned long crc = 0xFFFFFFFF;
+  for (unsigned i = 0; i < n; i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return (crc ^ 0xFFFFFFFF) & 0xFFFFFFFF;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// convert an IEEE 754 half precision value to double
+
+double LighthouseOOTX::readFloat16(unsigned offset) {
+  unsigned short h = bytes[offset] | (bytes[offset + 1] << 8);
+  int exponent = (h >> 10) & 0x1F;
+  int mantissa = h & 0x3FF;
+
+  double value;
+  if (exponent == 0) {
+    value = ldexp(mantissa, -24);                   // subnormal
+  } else if (exponent == 31) {
+    value = 0;                                      // inf or nan, ignore
+  } else {
+    value = ldexp(mantissa + 1024, exponent - 25);
+  }
+
+  return (h & 0x8000) ? -value : value;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// the fcal fields of both rotors are stored as float16 values, see
+// https://github.com/nairol/LighthouseRedox/blob/master/docs/Base%20Station.md
+
+void LighthouseOOTX::parseCalibration() {
+
+  baseStationID = (unsigned long)bytes[2] | ((unsigned long)bytes[3] << 8) |
+    ((unsigned long)bytes[4] << 16) | ((unsigned long)bytes[5] << 24);
+
+  for (int rotor = 0; rotor < 2; rotor++) {
+    calibration.phase[rotor]    = readFloat16(0x06 + 2*rotor);
+    calibration.tilt[rotor]     = readFloat16(0x0A + 2*rotor);
+    calibration.curve[rotor]    = readFloat16(0x10 + 2*rotor);
+    calibration.gibPhase[rotor] = readFloat16(0x17 + 2*rotor);
+    calibration.gibMag[rotor]   = readFloat16(0x1B + 2*rotor);
+  }
+  calibration.valid = true;
+
+  // add to the cache, or replace the oldest entry
+  int slot = nCachedCalibrations % calibrationCacheSize;
+  for (int i = 0; i < nCachedCalibrations && i < calibrationCacheSize; i++) {
+    if (cachedIDs[i] == baseStationID) {
+      slot = i;
+    }
+  }
+  if (slot == nCachedCalibrations % calibrationCacheSize) {
+    nCachedCalibrations++;
+  }
+  cachedIDs[slot] = baseStationID;
+  cachedCalibrations[slot] = calibration;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
+void LighthouseOOTX::lookUpCalibration() {
+
+  unsigned long id = (unsigned long)bytes[2] | ((unsigned long)bytes[3] << 8) |
+    ((unsigned long)bytes[4] << 16) | ((unsigned long)bytes[5] << 24);
+
+  if (calibration.valid && id == baseStationID) {
+    return;
+  }
+
+  // the calibration of another base station must not be used for this one.
+  // it is valid again once a frame of this one is decoded, or from the cache.
+  // the pitch, roll and mode are only known from a decoded frame
+  if (id != baseStationID) {
+    bCompleteOnce = false;
+  }
+  baseStationID = id;
+  calibration.valid = false;
+
+  for (int i = 0; i < nCachedCalibrations && i < calibrationCacheSize; i++) {
+    if (cachedIDs[i] == id) {
+      calibration = cachedCalibrations[i];
+      return;
+    }
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 // flip order of the last two bytes in a 32 bit variables
 // this seems necessary to reliably decode the data
@@ -220,7 +410,23 @@ void LighthouseOOTX::printAllData(void) {
     Serial.println(baseStationID,HEX);
 
     ///////////////////////////////////////////////////////////////////////////////////////
-    // bytes 7,8 and 9,10 are two double16 values for the phases of rotor 0 and 1
+    // bytes 7,8 and 9,10 are two float16 values for the phases of rotor 0 and 1,
+    // followed by the tilts. curve, gibphase and gibmag are stored after the accelerometer
+
+    const char *fieldNames[5] = {"phase", "tilt", "curve", "gibphase", "gibmag"};
+    const double *fields[5] = {calibration.phase, calibration.tilt, calibration.curve,
+      calibration.gibPhase, calibration.gibMag};
+    for (int i = 0; i < 5; i++) {
+      Serial.print("fcal ");
+      Serial.print(fieldNames[i]);
+      Serial.print(": ");
+      Serial.print(fields[i][0], 6);
+      Serial.print(", ");
+      Serial.println(fields[i][1], 6);
+    }
+
+    Serial.print("CRC errors: ");
+    Serial.println(crcErrors);
 
 
     ///////////////////////////////////////////////////////////////////////////////////////
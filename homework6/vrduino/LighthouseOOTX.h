@@ -5,6 +5,10 @@
  *  Details:  First, we will be looking for a preamble, that is a binary sequence of 17 zeros
  *            and 1 one. Then, we read the length of the payload and then the payload.
  *
+ *            The input capture ISR only pushes the data bits into a lock-free ring buffer
+ *            with pushBit(). The frame is decoded in the main loop by processBits(), so
+ *            that the trigonometry and printing at the end of a frame do not run in the ISR.
+ *
  *  OOTX Frame: details of the format of OOTX frames and also the code base of this class are
  *              adopted from nairol (https://github.com/nairol) - thanks for the documentation
  *              and the code !!
@@ -21,6 +25,27 @@
 
 #include <Wire.h>
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// factory calibration of the two rotors of a base station, from the OOTX frame.
+// index 0 is the rotor of the horizontal sweep, index 1 the one of the vertical sweep.
+// all angles are in radians. the measured sweep angle of a rotor is modeled as
+//   angle + phase + tan(tilt) * p + curve * p^2 + gibMag * sin(angle + gibPhase)
+// where angle is the ideal sweep angle and p the normalized coordinate (tangent of the
+// angle) of the other axis.
+
+struct BaseStationCalibration {
+
+  // true if the fields were read from a frame with a valid CRC
+  bool valid;
+
+  double phase[2];
+  double tilt[2];
+  double curve[2];
+  double gibPhase[2];
+  double gibMag[2];
+
+};
+
 class LighthouseOOTX {
 
   //////////////////////////////////////////////////////////////////////////////////////////
@@ -46,9 +71,15 @@ class LighthouseOOTX {
     unsigned rx_bytes;
     unsigned padding; // if there is a padding byte
 
-    // length of payload in bytes
+    // length of payload in bytes, including the CRC32
     unsigned length;
 
+    // length of payload in bytes, without the CRC32
+    unsigned payloadLength;
+
+    // number of frames that were dropped because the CRC32 did not match
+    unsigned crcErrors;
+
     // flag that indicates if the entire payload was read
     bool complete;
 
@@ -64,6 +95,30 @@ class LighthouseOOTX {
 
     int baseStationMode;
 
+    // unique identifier of the base station (only available after the identifier bytes
+    // of a frame were read)
+    unsigned long baseStationID;
+
+    // factory calibration of the base station
+    BaseStationCalibration calibration;
+
+    // factory calibration of previously seen base stations, so that a base station that
+    // is seen again is calibrated as soon as its identifier is read
+    static const int calibrationCacheSize = 4;
+    static unsigned long cachedIDs[calibrationCacheSize];
+    static BaseStationCalibration cachedCalibrations[calibrationCacheSize];
+    static int nCachedCalibrations;
+
+    // ring buffer of data bits that were not decoded yet. the ISR is the only writer of
+    // bitHead, the main loop the only writer of bitTail, so no locking is needed.
+    static const unsigned bitBufferSize = 256;
+    volatile uint32_t bitBuffer[bitBufferSize / 32];
+    volatile uint16_t bitHead;
+    volatile uint16_t bitTail;
+
+    // set by the ISR if the buffer was full and a bit was dropped
+    volatile bool bitOverflow;
+
   //////////////////////////////////////////////////////////////////////////////////////////
   // public variables
 
@@ -80,6 +135,18 @@ class LighthouseOOTX {
     // flip the order of the last two bytes in this 32 bit sequence (do not reverse bit order)
     unsigned long flipByteOrder(unsigned long bitsequence);
 
+    // CRC32 (IEEE 802.3, as in zlib) of a sequence of bytes
+    static unsigned long crc32(const unsigned char *data, unsigned n);
+
+    // little endian float16 value starting at the given byte of the payload
+    double readFloat16(unsigned offset);
+
+    // parse the factory calibration from a complete payload and add it to the cache
+    void parseCalibration();
+
+    // look up the calibration of the base station in the cache
+    void lookUpCalibration();
+
   //////////////////////////////////////////////////////////////////////////////////////////
   // public functions
   public:
@@ -90,10 +157,18 @@ class LighthouseOOTX {
     // add an incoming data bit for decoding
 	  void addBit(unsigned long bit);
 
+    // queue an incoming data bit for decoding. safe to call from the ISR
+    void pushBit(bool bit);
+
+    // decode all queued bits. call from the main loop.
+    // returns true if a frame was completed
+    bool processBits();
+
     // print all decoded data
     void printAllData(void);
 
-    // see if OOTX info is available
+    // see if OOTX info is available, i.e. a frame of the base station whose
+    // identifier was read last was decoded
     bool isOOTXInfoAvailable(void) { return bCompleteOnce; }
 
     // get pitch and roll angles of the base station from the OOTX frame - this is reported in degrees
@@ -101,6 +176,14 @@ class LighthouseOOTX {
 
     int getBaseStationMode();
 
+    // get the factory calibration of the base station. calibration.valid is false
+    // until a frame with a valid CRC was read, or the base station is in the cache.
+    // it is false again once the identifier of another, unknown base station is read
+    const BaseStationCalibration& getCalibration() const { return calibration; }
+
+    // number of frames that were dropped because the CRC32 did not match
+    unsigned getCrcErrors() const { return crcErrors; }
+
     void getBaseStationInfo(volatile double &pitch, volatile double &roll, volatile int &mode);
 
 };
@@ -0,0 +1,323 @@
+/**
+ * @file
+ * orientation filters of the imu, with a common interface:
+ *
+ *   class Filter {
+ *   public:
+ *     // alpha: complementary filter value [0,1]. filters with other
+ *     // gains derive them from it, see the filter
+ *     Filter(double alpha);
+ *
+ *     // updates the orientation estimate q with the gyro values (deg/s),
+ *     // the acc values (m/s^2) and the time since the previous sample (s)
+ *     void update(Quaternion& q, double gyr[3], double acc[3], double deltaT);
+ *
+ *     // clears the state of the filter besides q, see resetOrientation()
+ *     void reset();
+ *
+ *     // number of samples per tilt correction, 1: every sample. filters
+ *     // that correct the tilt with every sample ignore it
+ *     void setCorrectionInterval(int interval);
+ *
+ *     // method to integrate the gyro. filters that integrate it together
+ *     // with the correction ignore it
+ *     void setIntegration(GyroIntegration integration);
+ *
+ *     // name of the filter, for the benchmarks
+ *     static const char* name();
+ *   };
+ *
+ * the estimate q is kept by the caller, so that it can be corrected with
+ * a reference orientation, or extrapolated, independently of the filter.
+ *
+ * OrientationTracker holds a filter of the type ORIENTATION_FILTER for
+ * quaternionComp. the type is known at compile time, so the calls are
+ * inlined, without a virtual call per sample.
+ */
+
+#pragma once
+#include "Quaternion.h"
+#include "OrientationMath.h"
+
+/** methods to integrate the gyro */
+enum GyroIntegration {
+
+  GYRO_FIRST_ORDER, // rate of the current sample, see updateQuaternionGyr()
+  GYRO_CONING,      // second order, see updateQuaternionGyrConing()
+  GYRO_RK4          // Runge-Kutta 4th order, see updateQuaternionGyrRk4()
+
+};
+
+/**
+ * integrates the gyro with one of the GyroIntegration methods, and keeps
+ * the previous sample for the methods of higher order. they are more
+ * accurate for fast rotations, so the imu can be sampled at a lower rate
+ * for the same drift
+ */
+class GyroIntegrator {
+
+  public:
+
+    GyroIntegrator() :
+      integration(GYRO_FIRST_ORDER), gyrPrev{0, 0, 0}, hasPrev(false) {}
+
+    void setIntegration(GyroIntegration integration_) {
+      integration = integration_;
+      hasPrev = false;
+    }
+
+    GyroIntegration getIntegration() const { return integration; }
+
+    void update(Quaternion& q, double gyr[3], double deltaT) {
+
+      // the first sample has no previous one
+      if (integration == GYRO_FIRST_ORDER || !hasPrev) {
+        updateQuaternionGyr(q, gyr, deltaT);
+      } else if (integration == GYRO_CONING) {
+        updateQuaternionGyrConing(q, gyrPrev, gyr, deltaT);
+      } else {
+        updateQuaternionGyrRk4(q, gyrPrev, gyr, deltaT);
+      }
+
+      for (int i = 0; i < 3; i++) {
+        gyrPrev[i] = gyr[i];
+      }
+      hasPrev = true;
+
+    }
+
+    void reset() { hasPrev = false; }
+
+  private:
+
+    GyroIntegration integration;
+
+    /** gyro values of the previous sample */
+    double gyrPrev[3];
+
+    /** true if gyrPrev holds a sample */
+    bool hasPrev;
+
+};
+
+/**
+ * integrates the gyro only, see GyroIntegrator. drifts
+ */
+class GyroFilter {
+
+  public:
+
+    GyroFilter(double) {}
+
+    /** @returns the integrator, to select its method */
+    GyroIntegrator& getIntegrator() { return integrator; }
+
+    void update(Quaternion& q, double gyr[3], double /* acc */[3], double deltaT) {
+      integrator.update(q, gyr, deltaT);
+    }
+
+    void reset() { integrator.reset(); }
+
+    /** the tilt is not corrected */
+    void setCorrectionInterval(int) {}
+
+    void setIntegration(GyroIntegration integration) {
+      integrator.setIntegration(integration);
+    }
+
+    static const char* name() { return "gyro"; }
+
+  private:
+
+    GyroIntegrator integrator;
+
+};
+
+/**
+ * complementary filter of gyro and acc, see updateQuaternionComp().
+ * the gravity direction changes slowly, so the tilt correction, the
+ * expensive part, can be done every correctionInterval samples only,
+ * with alpha^correctionInterval, which corrects the same fraction of the
+ * tilt per time. the gyro is integrated with every sample, with the
+ * method of getIntegrator()
+ */
+class ComplementaryFilter {
+
+  public:
+
+    ComplementaryFilter(double alpha) :
+      alpha(alpha), alphaInterval(alpha), correctionInterval(1),
+      accTolerance(0), count(0) {}
+
+    /**
+     * @param interval - number of samples per tilt correction, 1: every sample
+     */
+    void setCorrectionInterval(int interval) {
+      correctionInterval = max(interval, 1);
+      alphaInterval = pow(alpha, correctionInterval);
+      count = 0;
+    }
+
+    /**
+     * @param tolerance - the tilt is not corrected with an acc sample
+     *   whose magnitude differs from 1 g by more than this fraction, e.g.
+     *   0.1. the acc then measures the motion too. 0: always correct
+     */
+    void setAccTolerance(double tolerance) { accTolerance = tolerance; }
+
+    /** @returns the integrator of the gyro, to select its method */
+    GyroIntegrator& getIntegrator() { return integrator; }
+
+    void setIntegration(GyroIntegration integration) {
+      integrator.setIntegration(integration);
+    }
+
+    void update(Quaternion& q, double gyr[3], double acc[3], double deltaT) {
+
+      if (correctionInterval == 1 && accTolerance <= 0 &&
+        integrator.getIntegration() == GYRO_FIRST_ORDER) {
+        updateQuaternionComp(q, gyr, acc, deltaT, alpha);
+        return;
+      }
+
+      integrator.update(q, gyr, deltaT);
+
+      if (++count < correctionInterval) {
+        return;
+      }
+      count = 0;
+
+      if (accTolerance > 0) {
+        double normA = sqrt(sq(acc[0]) + sq(acc[1]) + sq(acc[2]));
+        if (fabs(normA - GRAVITY) > accTolerance * GRAVITY) {
+          return;
+        }
+      }
+
+      updateQuaternionTilt(q, acc, alphaInterval);
+
+    }
+
+    void reset() {
+      count = 0;
+      integrator.reset();
+    }
+
+    static const char* name() { return "complementary"; }
+
+  private:
+
+    /** acc magnitude at rest in m/s^2 */
+    static constexpr double GRAVITY = 9.80665;
+
+    /** complementary filter value [0,1] */
+    double alpha;
+
+    /** alpha^correctionInterval */
+    double alphaInterval;
+
+    /** number of samples per tilt correction */
+    int correctionInterval;
+
+    /** relative deviation of the acc from 1 g, 0: not checked */
+    double accTolerance;
+
+    /** samples since the last tilt correction */
+    int count;
+
+    /** integrator of the gyro */
+    GyroIntegrator integrator;
+
+};
+
+/**
+ * Mahony filter, see updateQuaternionMahony(). the proportional gain
+ * kp = (1 - alpha) / deltaT corrects the same fraction of a small tilt
+ * per sample as the complementary filter. the integral term estimates
+ * the gyro bias that remains after the bias measurement
+ */
+class MahonyFilter {
+
+  public:
+
+    /**
+     * @param alpha - complementary filter value [0,1]
+     * @param ki - integral gain in 1/s^2, 0: no bias estimation
+     */
+    MahonyFilter(double alpha, double ki = 0.5) :
+      alpha(alpha), ki(ki), gyrBias{0, 0, 0} {}
+
+    void update(Quaternion& q, double gyr[3], double acc[3], double deltaT) {
+      // kp is not defined for the first sample
+      if (deltaT <= 0) {
+        return;
+      }
+      updateQuaternionMahony(q, gyrBias, gyr, acc, deltaT, (1 - alpha) / deltaT, ki);
+    }
+
+    void reset() {
+      gyrBias[0] = 0;
+      gyrBias[1] = 0;
+      gyrBias[2] = 0;
+    }
+
+    /** the tilt is corrected with every sample */
+    void setCorrectionInterval(int) {}
+
+    /** the gyro is integrated with the correction, first order */
+    void setIntegration(GyroIntegration) {}
+
+    static const char* name() { return "mahony"; }
+
+    /** @returns estimate of the remaining gyro bias in deg/s */
+    const double* getGyrBias() const { return gyrBias; }
+
+  private:
+
+    /** complementary filter value [0,1] */
+    double alpha;
+
+    /** integral gain in 1/s^2 */
+    double ki;
+
+    /** estimate of the remaining gyro bias in deg/s */
+    double gyrBias[3];
+
+};
+
+/**
+ * Madgwick filter, see updateQuaternionMadgwick(). the tilt is corrected
+ * at a rate of up to 2 * beta rad/s, independent of the sample rate.
+ * alpha 1 turns the correction off, like for the complementary filter
+ */
+class MadgwickFilter {
+
+  public:
+
+    /**
+     * @param alpha - complementary filter value [0,1], only 1 is used
+     * @param beta - gain in rad/s
+     */
+    MadgwickFilter(double alpha, double beta = 0.1) :
+      beta(alpha < 1 ? beta : 0) {}
+
+    void update(Quaternion& q, double gyr[3], double acc[3], double deltaT) {
+      updateQuaternionMadgwick(q, gyr, acc, deltaT, beta);
+    }
+
+    void reset() {}
+
+    /** the tilt is corrected with every sample */
+    void setCorrectionInterval(int) {}
+
+    /** the gyro is integrated with the correction, first order */
+    void setIntegration(GyroIntegration) {}
+
+    static const char* name() { return "madgwick"; }
+
+  private:
+
+    /** gain in rad/s */
+    double beta;
+
+};
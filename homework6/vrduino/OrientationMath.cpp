@@ -91,3 +91,222 @@ void updateQuaternionComp(Quaternion& q, double gyr[3], double acc[3], double de
   q = Quaternion().multiply(qt, qw).normalize();
 
 }
+
+
+/** see documentation in header file */
+Quaternion updateQuaternionRef(Quaternion& q, Quaternion& qRef, double beta, bool yawOnly) {
+
+  // orientation error in world frame, along the shortest path
+  Quaternion qInv = q.clone().inverse();
+  Quaternion qErr = Quaternion().multiply(qRef, qInv);
+  if (qErr.q[0] < 0) {
+    for (int i = 0; i < 4; i++) {
+      qErr.q[i] = -qErr.q[i];
+    }
+  }
+
+  // the twist about the y-axis is the yaw error
+  double v[3] = {qErr.q[1], qErr.q[2], qErr.q[3]};
+  if (yawOnly) {
+    v[0] = 0;
+    v[2] = 0;
+  }
+
+  double normV = sqrt( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+  Quaternion qCorr;
+  if (normV >= 1e-8) { // really important to prevent division by zero on Teensy!
+    double angle = 2 * RAD_TO_DEG * atan2(normV, qErr.q[0]);
+    qCorr = Quaternion().setFromAngleAxis( beta*angle, v[0]/normV, v[1]/normV, v[2]/normV);
+  }
+
+  q = Quaternion().multiply(qCorr, q).normalize();
+
+  return qCorr;
+
+}
+
+/**
+ * computes the up direction (world y-axis) in the imu frame for the
+ * orientation q, i.e. the direction the acc measures at rest
+ */
+static void computeUpDirection(const Quaternion& q, double up[3]) {
+
+  const double* p = q.q;
+  up[0] = 2 * (p[1] * p[2] + p[0] * p[3]);
+  up[1] = 1 - 2 * (p[1] * p[1] + p[3] * p[3]);
+  up[2] = 2 * (p[2] * p[3] - p[0] * p[1]);
+
+}
+
+/**
+ * computes the rate dq = 0.5 * p * (0, w) of the quaternion p (w, x, y, z)
+ * for the angular velocity w in rad/s
+ */
+static void computeQuaternionRate(const double p[4], const double w[3], double dq[4]) {
+
+  dq[0] = 0.5 * (-p[1] * w[0] - p[2] * w[1] - p[3] * w[2]);
+  dq[1] = 0.5 * ( p[0] * w[0] + p[2] * w[2] - p[3] * w[1]);
+  dq[2] = 0.5 * ( p[0] * w[1] - p[1] * w[2] + p[3] * w[0]);
+  dq[3] = 0.5 * ( p[0] * w[2] + p[1] * w[1] - p[2] * w[0]);
+
+}
+
+/**
+ * integrates q' = 0.5 * q * (0, w) over deltaT, first order, with w in
+ * rad/s, and subtracts step, a rate of q, e.g. of a correction
+ */
+static void integrateQuaternionRate(Quaternion& q, double w[3],
+  double step[4], double deltaT) {
+
+  double dq[4];
+  computeQuaternionRate(q.q, w, dq);
+  for (int i = 0; i < 4; i++) {
+    q.q[i] += (dq[i] - step[i]) * deltaT;
+  }
+  q.normalize();
+
+}
+
+void updateQuaternionMahony(Quaternion& q, double gyrBias[3], double gyr[3],
+  double acc[3], double deltaT, double kp, double ki) {
+
+  double w[3];
+  for (int i = 0; i < 3; i++) {
+    w[i] = DEG_TO_RAD * (gyr[i] - gyrBias[i]);
+  }
+
+  double normA = sqrt(sq(acc[0]) + sq(acc[1]) + sq(acc[2]));
+  if (normA >= 1e-8) {
+
+    double up[3];
+    computeUpDirection(q, up);
+
+    // rotation from the estimated to the measured up direction
+    double e[3] = {
+      (acc[1] * up[2] - acc[2] * up[1]) / normA,
+      (acc[2] * up[0] - acc[0] * up[2]) / normA,
+      (acc[0] * up[1] - acc[1] * up[0]) / normA
+    };
+
+    for (int i = 0; i < 3; i++) {
+      gyrBias[i] -= RAD_TO_DEG * ki * e[i] * deltaT;
+      w[i] += kp * e[i];
+    }
+
+  }
+
+  double step[4] = {0, 0, 0, 0};
+  integrateQuaternionRate(q, w, step, deltaT);
+
+}
+
+void updateQuaternionMadgwick(Quaternion& q, double gyr[3], double acc[3],
+  double deltaT, double beta) {
+
+  double w[3] = {DEG_TO_RAD * gyr[0], DEG_TO_RAD * gyr[1], DEG_TO_RAD * gyr[2]};
+  double step[4] = {0, 0, 0, 0};
+
+  double normA = sqrt(sq(acc[0]) + sq(acc[1]) + sq(acc[2]));
+  if (normA >= 1e-8) {
+
+    double up[3];
+    computeUpDirection(q, up);
+
+    // error f = up - acc, and its gradient J^T f in q
+    double f[3] = {
+      up[0] - acc[0] / normA, up[1] - acc[1] / normA, up[2] - acc[2] / normA
+    };
+    const double* p = q.q;
+    double g[4] = {
+      2 * (p[3] * f[0] - p[1] * f[2]),
+      2 * (p[2] * f[0] - 2 * p[1] * f[1] - p[0] * f[2]),
+      2 * (p[1] * f[0] + p[3] * f[2]),
+      2 * (p[0] * f[0] - 2 * p[3] * f[1] + p[2] * f[2])
+    };
+
+    double normG = sqrt(sq(g[0]) + sq(g[1]) + sq(g[2]) + sq(g[3]));
+    if (normG >= 1e-8) {
+      for (int i = 0; i < 4; i++) {
+        step[i] = beta * g[i] / normG;
+      }
+    }
+
+  }
+
+  integrateQuaternionRate(q, w, step, deltaT);
+
+}
+
+void updateQuaternionTilt(Quaternion& q, double acc[3], double alpha) {
+
+  // get accelerometer quaternion in world
+  Quaternion qa = Quaternion(0, acc[0], acc[1], acc[2]).rotate(q);
+
+  // angle between the acc and the world y-axis
+  double normA = sqrt(sq(qa.q[1]) + sq(qa.q[2]) + sq(qa.q[3]));
+  double normN = sqrt(sq(qa.q[1]) + sq(qa.q[3]));
+  if (normA < 1e-8 || normN < 1e-8) {
+    return;
+  }
+  double phi = RAD_TO_DEG * acos(constrain(qa.q[2] / normA, -1.0, 1.0));
+
+  // rotate a fraction of the angle about the axis perpendicular to both
+  Quaternion qt = Quaternion().setFromAngleAxis(
+    (1 - alpha) * phi, -qa.q[3] / normN, 0.0, qa.q[1] / normN);
+  q = Quaternion().multiply(qt, q).normalize();
+
+}
+
+void updateQuaternionGyrConing(Quaternion& q, double gyrPrev[3], double gyr[3], double deltaT) {
+
+  // rotation vector in deg: trapezoid of the rates, and the coning
+  // correction (gyrPrev x gyr) * deltaT^2 / 12, converted from rad^2
+  double c = DEG_TO_RAD * deltaT * deltaT / 12;
+  double phi[3] = {
+    0.5 * (gyrPrev[0] + gyr[0]) * deltaT + c * (gyrPrev[1] * gyr[2] - gyrPrev[2] * gyr[1]),
+    0.5 * (gyrPrev[1] + gyr[1]) * deltaT + c * (gyrPrev[2] * gyr[0] - gyrPrev[0] * gyr[2]),
+    0.5 * (gyrPrev[2] + gyr[2]) * deltaT + c * (gyrPrev[0] * gyr[1] - gyrPrev[1] * gyr[0])
+  };
+
+  double normPhi = sqrt(sq(phi[0]) + sq(phi[1]) + sq(phi[2]));
+  if (normPhi < 1e-8) {
+    return;
+  }
+
+  Quaternion qDelta = Quaternion().setFromAngleAxis(
+    normPhi, phi[0] / normPhi, phi[1] / normPhi, phi[2] / normPhi);
+  q = Quaternion().multiply(q, qDelta).normalize();
+
+}
+
+void updateQuaternionGyrRk4(Quaternion& q, double gyrPrev[3], double gyr[3], double deltaT) {
+
+  // angular velocity in rad/s at the start, middle and end of the interval
+  double w0[3], wm[3], w1[3];
+  for (int i = 0; i < 3; i++) {
+    w0[i] = DEG_TO_RAD * gyrPrev[i];
+    w1[i] = DEG_TO_RAD * gyr[i];
+    wm[i] = 0.5 * (w0[i] + w1[i]);
+  }
+
+  double k1[4], k2[4], k3[4], k4[4], p[4];
+  computeQuaternionRate(q.q, w0, k1);
+  for (int i = 0; i < 4; i++) {
+    p[i] = q.q[i] + 0.5 * deltaT * k1[i];
+  }
+  computeQuaternionRate(p, wm, k2);
+  for (int i = 0; i < 4; i++) {
+    p[i] = q.q[i] + 0.5 * deltaT * k2[i];
+  }
+  computeQuaternionRate(p, wm, k3);
+  for (int i = 0; i < 4; i++) {
+    p[i] = q.q[i] + deltaT * k3[i];
+  }
+  computeQuaternionRate(p, w1, k4);
+
+  for (int i = 0; i < 4; i++) {
+    q.q[i] += deltaT / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+  }
+  q.normalize();
+
+}
@@ -67,6 +67,19 @@ double computeFlatlandRollComp(double flatlandRollCompPrev, double gyr[3],  doub
 void updateQuaternionComp(Quaternion& q, double gyr[3], double acc[3], double deltaT, double alpha);
 
 
+/**
+ * blends a reference orientation into the quaternion estimate, e.g. the
+ * orientation from the lighthouse. this corrects the drift of the yaw,
+ * which the acc cannot observe.
+ * @param[in, out] q - orientation estimate, updated
+ * @param[in] qRef - reference orientation, in the same world frame as q
+ * @param[in] beta - fraction [0,1] of the orientation error that is corrected
+ * @param[in] yawOnly - if true, only correct the rotation about the world y-axis
+ * @returns the correction that was applied to q, i.e. q = correction * q
+ */
+Quaternion updateQuaternionRef(Quaternion& q, Quaternion& qRef, double beta, bool yawOnly);
+
+
 /**
  * update the quaternion estimate using imu gyro values
  * @param[in, out] q - previous orientation estimate.
@@ -76,3 +89,72 @@ void updateQuaternionComp(Quaternion& q, double gyr[3], double acc[3], double de
  *
  */
 void updateQuaternionGyr(Quaternion& q, double gyr[3], double deltaT);
+
+
+/**
+ * update the quaternion estimate with the Mahony filter: the gyro rate is
+ * corrected with the cross product of the measured up direction (acc) and
+ * the up direction of q, and with the integral of it, which estimates the
+ * remaining gyro bias.
+ * @param[in, out] q - previous orientation estimate, updated
+ * @param[in, out] gyrBias - remaining gyro bias in deg/s, updated
+ * @param[in] gyr - current gyro values (pitch, yaw, roll)
+ * @param[in] acc - current acc values (ax, ay, az)
+ * @param[in] deltaT - time since previous imu reading in seconds
+ * @param[in] kp - proportional gain in 1/s
+ * @param[in] ki - integral gain in 1/s^2
+ */
+void updateQuaternionMahony(Quaternion& q, double gyrBias[3], double gyr[3],
+  double acc[3], double deltaT, double kp, double ki);
+
+
+/**
+ * update the quaternion estimate with the Madgwick filter: the rate of q
+ * from the gyro is corrected with a step along the normalized gradient of
+ * the error between the up direction of q and the measured one (acc).
+ * @param[in, out] q - previous orientation estimate, updated
+ * @param[in] gyr - current gyro values (pitch, yaw, roll)
+ * @param[in] acc - current acc values (ax, ay, az)
+ * @param[in] deltaT - time since previous imu reading in seconds
+ * @param[in] beta - gain in rad/s, the tilt is corrected by up to 2 * beta
+ */
+void updateQuaternionMadgwick(Quaternion& q, double gyr[3], double acc[3],
+  double deltaT, double beta);
+
+
+/**
+ * corrects the tilt of the quaternion estimate with the acc values, the
+ * correction step of updateQuaternionComp() without the gyro integration
+ * @param[in, out] q - orientation estimate, updated
+ * @param[in] acc - current acc values (ax, ay, az)
+ * @param[in] alpha - complementary filter alpha value, 1 - alpha of the
+ *   tilt is corrected
+ */
+void updateQuaternionTilt(Quaternion& q, double acc[3], double alpha);
+
+
+/**
+ * update the quaternion estimate with the gyro values of the previous and
+ * the current sample, to second order: the rate is assumed to change
+ * linearly between the samples, and the coning of the axis is corrected.
+ * more accurate than updateQuaternionGyr() for fast rotations, at the
+ * same cost.
+ * @param[in, out] q - previous orientation estimate, updated
+ * @param[in] gyrPrev - gyro values of the previous sample (pitch, yaw, roll)
+ * @param[in] gyr - current gyro values (pitch, yaw, roll)
+ * @param[in] deltaT - time since previous imu reading in seconds
+ */
+void updateQuaternionGyrConing(Quaternion& q, double gyrPrev[3], double gyr[3], double deltaT);
+
+
+/**
+ * update the quaternion estimate with the gyro values of the previous and
+ * the current sample, with the Runge-Kutta method of 4th order of
+ * q' = 0.5 * q * (0, w). the rate is assumed to change linearly between
+ * the samples.
+ * @param[in, out] q - previous orientation estimate, updated
+ * @param[in] gyrPrev - gyro values of the previous sample (pitch, yaw, roll)
+ * @param[in] gyr - current gyro values (pitch, yaw, roll)
+ * @param[in] deltaT - time since previous imu reading in seconds
+ */
+void updateQuaternionGyrRk4(Quaternion& q, double gyrPrev[3], double gyr[3], double deltaT);
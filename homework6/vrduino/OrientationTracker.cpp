@@ -1,25 +1,33 @@
 #include "OrientationTracker.h"
 
-OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateImuIn) :
+OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateImuIn,
+  int estimatorsIn) :
 
   imu(),
   gyr{0,0,0},
   acc{0,0,0},
   gyrBias{0,0,0},
+  gyrBiasModel(),
+  learnGyrBias(false),
   gyrVariance{0,0,0},
   accBias{0,0,0},
   accVariance{0,0,0},
-  previousTimeImu(0),
+  timestampImu(0),
   imuFilterAlpha(imuFilterAlphaIn),
+  referenceGain(0.02),
   deltaT(0.0),
   simulateImu(simulateImuIn),
   simulateImuCounter(0),
+  estimators(estimatorsIn & ORIENTATION_ESTIMATORS),
+  currentEstimators(0),
   flatlandRollGyr(0),
   flatlandRollAcc(0),
   flatlandRollComp(0),
   quaternionGyr{1,0,0,0},
   eulerAcc{0,0,0},
-  quaternionComp{1,0,0,0}
+  quaternionComp{1,0,0,0},
+  filter(imuFilterAlphaIn),
+  orientationCycles()
 
   {
 
@@ -27,6 +35,7 @@ OrientationTracker::OrientationTracker(double imuFilterAlphaIn,  bool simulateIm
 
 void OrientationTracker::initImu() {
   imu.init();
+  enableCycleCounter();
 }
 
 
@@ -46,6 +55,8 @@ void OrientationTracker::measureImuBiasVariance() {
   double accSum[3] = {0, 0, 0};
   double accSquaredSum[3] = {0, 0, 0};
 
+  double temperatureSum = 0;
+
   int nRead = 0;
 
   while (nRead < N) {
@@ -71,6 +82,8 @@ void OrientationTracker::measureImuBiasVariance() {
       accSquaredSum[1] += sq(imu.accY);
       accSquaredSum[2] += sq(imu.accZ);
 
+      temperatureSum += imu.temperature;
+
       nRead++;
     }
 
@@ -88,14 +101,19 @@ void OrientationTracker::measureImuBiasVariance() {
 
   }
 
+  //the bias is the one at the mean temperature of the measurements
+  gyrBiasModel.setVariance(gyrVariance);
+  gyrBiasModel.setBias(gyrBias, temperatureSum/N, N);
+
 
 }
 
-void OrientationTracker::setImuBias(double bias[3]) {
+void OrientationTracker::setImuBias(double bias[3], double temperature) {
 
   for (int i = 0; i < 3; i++) {
     gyrBias[i] = bias[i];
   }
+  gyrBiasModel.setBias(gyrBias, temperature);
 
 }
 
@@ -109,6 +127,24 @@ void OrientationTracker::resetOrientation() {
   eulerAcc[1] = 0;
   eulerAcc[2] = 0;
   quaternionComp = Quaternion();
+  filter.reset();
+  currentEstimators = 0;
+
+}
+
+Quaternion OrientationTracker::predict(double dtAhead) {
+
+  Quaternion q = quaternionComp.clone();
+  if (dtAhead > 0) {
+    updateQuaternionGyr(q, gyr, dtAhead);
+  }
+  return q;
+
+}
+
+Quaternion OrientationTracker::updateOrientationReference(Quaternion& qRef, bool yawOnly) {
+
+  return updateQuaternionRef(quaternionComp, qRef, referenceGain, yawOnly);
 
 }
 
@@ -132,7 +168,9 @@ bool OrientationTracker::processImu() {
   }
 
   //run orientation tracking algorithms
+  uint32_t startCycles = getCycleCount();
   updateOrientation();
+  orientationCycles.add(getCycleCount() - startCycles);
 
   return true;
 
@@ -141,6 +179,7 @@ bool OrientationTracker::processImu() {
 void OrientationTracker::updateImuVariablesFromSimulation() {
 
     deltaT = 0.002;
+    timestampImu = InputCapture::now();
     //get simulated imu values from external file
     for (int i = 0; i < 3; i++) {
       gyr[i] = imuData[simulateImuCounter + i];
@@ -168,26 +207,32 @@ bool OrientationTracker::updateImuVariables() {
     return false;
   }
 
-  double currentTimeImu = micros()/1000000.0;
+  // the timestamp is taken when the data is ready, before the transfer
+  uint64_t currentTimestamp = imu.timestamp;
 
-  if (previousTimeImu == 0.0) {
+  if (timestampImu == 0) {
   // first reading, set prev time to current
-    previousTimeImu = currentTimeImu;
+    timestampImu = currentTimestamp;
   }
 
   // Compute the elapsed time from the previous iteration
-  deltaT = currentTimeImu - previousTimeImu;
-  previousTimeImu = currentTimeImu;
-
-  // remove bias from the gyro measurements
-  gyr[0] = imu.gyrX - gyrBias[0];
-  gyr[1] = imu.gyrY - gyrBias[1];
-  gyr[2] = imu.gyrZ - gyrBias[2];
+  deltaT = InputCapture::ticksToSeconds(currentTimestamp - timestampImu);
+  timestampImu = currentTimestamp;
 
   acc[0] = imu.accX;
   acc[1] = imu.accY;
   acc[2] = imu.accZ;
 
+  // remove the bias at the current temperature from the gyro measurements
+  double gyrRaw[3] = {imu.gyrX, imu.gyrY, imu.gyrZ};
+  if (learnGyrBias) {
+    gyrBiasModel.addSample(gyrRaw, acc, imu.temperature);
+  }
+  gyrBiasModel.computeBias(imu.temperature, gyrBias);
+  gyr[0] = gyrRaw[0] - gyrBias[0];
+  gyr[1] = gyrRaw[1] - gyrBias[1];
+  gyr[2] = gyrRaw[2] - gyrBias[2];
+
   return true;
 
 }
@@ -198,23 +243,46 @@ bool OrientationTracker::updateImuVariables() {
  */
 void OrientationTracker::updateOrientation() {
 
+  //ORIENTATION_ESTIMATORS is a constant, estimators that are not compiled
+  //in are removed as dead code
+  int enabled = estimators & ORIENTATION_ESTIMATORS;
+
   //flatland roll estimate
-  flatlandRollGyr = computeFlatlandRollGyr(
-    flatlandRollGyr, gyr, deltaT);
+  if (enabled & EST_FLATLAND_GYR) {
+    flatlandRollGyr = computeFlatlandRollGyr(
+      flatlandRollGyr, gyr, deltaT);
+  }
+
+  //the flatland comp filter corrects with the acc roll
+  if (enabled & EST_FLATLAND_COMP) {
+    enabled |= EST_FLATLAND_ACC;
+  }
 
-  flatlandRollAcc = computeFlatlandRollAcc(acc);
+  if (enabled & EST_FLATLAND_ACC) {
+    flatlandRollAcc = computeFlatlandRollAcc(acc);
+  }
 
-  flatlandRollComp = computeFlatlandRollComp(
-    flatlandRollComp, gyr, flatlandRollAcc, deltaT, imuFilterAlpha);
+  if (enabled & EST_FLATLAND_COMP) {
+    flatlandRollComp = computeFlatlandRollComp(
+      flatlandRollComp, gyr, flatlandRollAcc, deltaT, imuFilterAlpha);
+  }
 
   //updates quaternion estimate with only gyro values
-  updateQuaternionGyr(quaternionGyr, gyr, deltaT);
+  if (enabled & EST_QUATERNION_GYR) {
+    updateQuaternionGyr(quaternionGyr, gyr, deltaT);
+  }
 
   //performs euler complementary filtering with gyro and acc values
-  eulerAcc[0] = computeAccPitch(acc);
-  eulerAcc[2] = computeAccRoll(acc);
+  if (enabled & EST_EULER_ACC) {
+    eulerAcc[0] = computeAccPitch(acc);
+    eulerAcc[2] = computeAccRoll(acc);
+  }
+
+  //performs quaternion filtering with gyro and acc values
+  if (enabled & EST_QUATERNION_COMP) {
+    filter.update(quaternionComp, gyr, acc, deltaT);
+  }
 
-  //performs quaternion complementary filtering with gyro and acc values
-  updateQuaternionComp(quaternionComp, gyr, acc, deltaT, imuFilterAlpha);
+  currentEstimators = enabled;
 
 }
@@ -0,0 +1,277 @@
+#include "PoseEkf.h"
+
+/** standard gravity in mm/s^2 */
+static const double GRAVITY_MM = 9806.65;
+
+PoseEkf::PoseEkf() :
+
+  valid(false),
+  quaternion(),
+  position{0,0,-500},
+  velocity{0,0,0},
+  gyrBias{0,0,0},
+  up{0,1,0},
+  P{{0}},
+  PhiRotBias{{0}},
+  PhiVelRot{{0}},
+  PhiDeltaT(0)
+
+  {
+
+}
+
+void PoseEkf::reset(Quaternion& q, double pos[3]) {
+
+  quaternion = q;
+  for (int i = 0; i < 3; i++) {
+    position[i] = pos[i];
+    velocity[i] = 0;
+    gyrBias[i] = 0;
+  }
+
+  //initial std. dev.: 0.01 rad, 5 mm, 100 mm/s, 0.01 rad/s
+  double sigma[4] = {0.01, 5, 100, 0.01};
+  for (int i = 0; i < 12; i++) {
+    for (int j = 0; j < 12; j++) {
+      P[i][j] = 0;
+    }
+    P[i][i] = sq(sigma[i / 3]);
+  }
+
+  valid = true;
+
+}
+
+void PoseEkf::setUp(double upIn[3]) {
+
+  for (int i = 0; i < 3; i++) {
+    up[i] = upIn[i];
+  }
+
+}
+
+void PoseEkf::propagate(double gyr[3], double acc[3], double deltaT) {
+
+  if (!valid || deltaT <= 0) {
+    return;
+  }
+
+  //rotation matrix of the current orientation
+  double w = quaternion.q[0];
+  double x = quaternion.q[1];
+  double y = quaternion.q[2];
+  double z = quaternion.q[3];
+  double R[3][3] = {
+    {1 - 2*(y*y + z*z), 2*(x*y - w*z),     2*(x*z + w*y)},
+    {2*(x*y + w*z),     1 - 2*(x*x + z*z), 2*(y*z - w*x)},
+    {2*(x*z - w*y),     2*(y*z + w*x),     1 - 2*(x*x + y*y)}
+  };
+
+  //specific force in the base station frame, in mm/s^2.
+  //at rest, the acc measures the reaction to gravity, i.e. up
+  double f[3];
+  for (int i = 0; i < 3; i++) {
+    f[i] = 1000 * (R[i][0]*acc[0] + R[i][1]*acc[1] + R[i][2]*acc[2]);
+  }
+
+  //nominal state
+  for (int i = 0; i < 3; i++) {
+    double a = f[i] - GRAVITY_MM * up[i];
+    position[i] += velocity[i] * deltaT + 0.5 * a * sq(deltaT);
+    velocity[i] += a * deltaT;
+  }
+
+  double omega[3];
+  for (int i = 0; i < 3; i++) {
+    omega[i] = radians(gyr[i]) - gyrBias[i];
+  }
+  double omegaNorm = sqrt(sq(omega[0]) + sq(omega[1]) + sq(omega[2]));
+  if (omegaNorm > 0) {
+    Quaternion dq = Quaternion().setFromAngleAxis(degrees(omegaNorm * deltaT),
+      omega[0] / omegaNorm, omega[1] / omegaNorm, omega[2] / omegaNorm);
+    quaternion = Quaternion().multiply(quaternion, dq).normalize();
+  }
+
+  //transition matrix of the error state
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      PhiRotBias[i][j] = -R[i][j] * deltaT;
+    }
+  }
+  PhiVelRot[0][0] = 0;
+  PhiVelRot[0][1] = f[2] * deltaT;
+  PhiVelRot[0][2] = -f[1] * deltaT;
+  PhiVelRot[1][0] = -f[2] * deltaT;
+  PhiVelRot[1][1] = 0;
+  PhiVelRot[1][2] = f[0] * deltaT;
+  PhiVelRot[2][0] = f[1] * deltaT;
+  PhiVelRot[2][1] = -f[0] * deltaT;
+  PhiVelRot[2][2] = 0;
+  PhiDeltaT = deltaT;
+
+  //P = Phi P Phi^T. Phi (Phi P)^T equals it since P is symmetric
+  multiplyTransition(P);
+  for (int i = 0; i < 12; i++) {
+    for (int j = i + 1; j < 12; j++) {
+      double tmp = P[i][j];
+      P[i][j] = P[j][i];
+      P[j][i] = tmp;
+    }
+  }
+  multiplyTransition(P);
+
+  //process noise
+  for (int i = 0; i < 3; i++) {
+    P[i][i] += sq(gyrNoise) * deltaT;
+    P[6 + i][6 + i] += sq(accNoise) * deltaT;
+    P[9 + i][9 + i] += sq(gyrBiasNoise) * deltaT;
+  }
+
+}
+
+void PoseEkf::multiplyTransition(double M[12][12]) {
+
+  //only the rows of rotation, position and velocity error change.
+  //position uses the old velocity rows, velocity the old rotation rows,
+  //so update them in this order.
+  for (int j = 0; j < 12; j++) {
+
+    for (int i = 0; i < 3; i++) {
+      M[3 + i][j] += PhiDeltaT * M[6 + i][j];
+    }
+
+    for (int i = 0; i < 3; i++) {
+      M[6 + i][j] += PhiVelRot[i][0] * M[0][j] + PhiVelRot[i][1] * M[1][j] +
+        PhiVelRot[i][2] * M[2][j];
+    }
+
+    for (int i = 0; i < 3; i++) {
+      M[i][j] += PhiRotBias[i][0] * M[9][j] + PhiRotBias[i][1] * M[10][j] +
+        PhiRotBias[i][2] * M[11][j];
+    }
+
+  }
+
+}
+
+bool PoseEkf::correct(double pos2D[8], double posRef[8], double weights[8]) {
+
+  if (!valid) {
+    return false;
+  }
+
+  double residualAll[8];
+  double JAll[8][6];
+  if (!getReprojectionJacobian(pos2D, posRef, quaternion, position, residualAll, JAll)) {
+    return false;
+  }
+
+  //use the entries with a detection only
+  int m = 0;
+  double r[8];
+  double H[8][6];
+  double noise[8];
+  for (int i = 0; i < 8; i++) {
+    if (weights[i] > 0) {
+      r[m] = residualAll[i];
+      for (int j = 0; j < 6; j++) {
+        H[m][j] = JAll[i][j];
+      }
+      noise[m] = sq(pos2DNoise) / weights[i];
+      m++;
+    }
+  }
+
+  if (m == 0) {
+    return false;
+  }
+
+  //the measurements only depend on rotation and position error,
+  //so H has 6 non-zero columns. PHt = P H^T (12 x m)
+  double PHt[12][8];
+  for (int i = 0; i < 12; i++) {
+    for (int k = 0; k < m; k++) {
+      double sum = 0;
+      for (int j = 0; j < 6; j++) {
+        sum += P[i][j] * H[k][j];
+      }
+      PHt[i][k] = sum;
+    }
+  }
+
+  //S = H P H^T + R (m x m), stored densely for Matrix.Invert
+  double S[64];
+  for (int k = 0; k < m; k++) {
+    for (int l = 0; l < m; l++) {
+      double sum = 0;
+      for (int j = 0; j < 6; j++) {
+        sum += H[k][j] * PHt[j][l];
+      }
+      S[k * m + l] = sum + ((k == l) ? noise[k] : 0);
+    }
+  }
+
+  if (not Matrix.Invert(S, m)) {
+    return false;
+  }
+
+  //reject outliers with the normalized innovation squared
+  double nis = 0;
+  for (int k = 0; k < m; k++) {
+    for (int l = 0; l < m; l++) {
+      nis += r[k] * S[k * m + l] * r[l];
+    }
+  }
+  if (nis > maxInnovation) {
+    return false;
+  }
+
+  //K = PHt S^-1 (12 x m)
+  double K[12][8];
+  for (int i = 0; i < 12; i++) {
+    for (int l = 0; l < m; l++) {
+      double sum = 0;
+      for (int k = 0; k < m; k++) {
+        sum += PHt[i][k] * S[k * m + l];
+      }
+      K[i][l] = sum;
+    }
+  }
+
+  //error state and covariance update: P = P - K (P H^T)^T
+  double dx[12];
+  for (int i = 0; i < 12; i++) {
+    double sum = 0;
+    for (int k = 0; k < m; k++) {
+      sum += K[i][k] * r[k];
+    }
+    dx[i] = sum;
+  }
+
+  for (int i = 0; i < 12; i++) {
+    for (int j = i; j < 12; j++) {
+      double sum = 0;
+      for (int k = 0; k < m; k++) {
+        sum += K[i][k] * PHt[j][k];
+      }
+      P[i][j] -= sum;
+      P[j][i] = P[i][j];
+    }
+  }
+
+  //inject the error state into the nominal state
+  double angle = sqrt(sq(dx[0]) + sq(dx[1]) + sq(dx[2]));
+  if (angle > 0) {
+    Quaternion dq = Quaternion().setFromAngleAxis(degrees(angle),
+      dx[0] / angle, dx[1] / angle, dx[2] / angle);
+    quaternion = Quaternion().multiply(dq, quaternion).normalize();
+  }
+  for (int i = 0; i < 3; i++) {
+    position[i] += dx[3 + i];
+    velocity[i] += dx[6 + i];
+    gyrBias[i] += dx[9 + i];
+  }
+
+  return true;
+
+}
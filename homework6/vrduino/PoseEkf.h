@@ -0,0 +1,134 @@
+/**
+ * @class PoseEkf
+ * Error-state extended Kalman filter that fuses the IMU with the lighthouse.
+ *
+ * The nominal state is the orientation and position of the board in the
+ * base station frame, its velocity, and the residual gyro bias. It is
+ * propagated with every IMU sample. The error state has 12 elements:
+ * [rotation error (3), position error (3), velocity error (3), gyro bias error (3)].
+ * The rotation error is a small rotation in the base station frame.
+ *
+ * The corrections use the 2D projections of the photodiodes directly, not
+ * the pose estimated from them, so frames with occluded diodes still
+ * contribute the diodes that are visible.
+ *
+ * Units: mm, mm/s, rad/s internally. The IMU inputs are deg/s and m/s^2.
+ * All the pose math is done in PoseMath.h
+ */
+
+#pragma once
+#include "PoseMath.h"
+#include "Quaternion.h"
+
+class PoseEkf {
+
+  public:
+
+    /** constructor. the filter is invalid until reset() is called */
+    PoseEkf();
+
+    /**
+     * (re)initializes the state with a pose, zero velocity and zero gyro
+     * bias, and sets the initial covariance
+     * @param [in] q - orientation of the board in the base station frame
+     * @param [in] pos - position of the board in the base station frame, in mm
+     */
+    void reset(Quaternion& q, double pos[3]);
+
+    /**
+     * sets the direction of gravity
+     * @param [in] upIn - unit up vector in the base station frame
+     */
+    void setUp(double upIn[3]);
+
+    /**
+     * propagates the state and the covariance by one IMU sample
+     * @param [in] gyr - gyro values (x,y,z) in deg/s, in the IMU frame
+     * @param [in] acc - acc values (x,y,z) in m/s^2, in the IMU frame
+     * @param [in] deltaT - time since the previous sample in s
+     */
+    void propagate(double gyr[3], double acc[3], double deltaT);
+
+    /**
+     * corrects the state with the 2D projections of the photodiodes
+     * @param [in] pos2D - measured 2D projections on the plane at unit distance.
+     *   order is [sensor0x, sensor0y, ... sensor3x, sensor3y]
+     * @param [in] posRef - 2D positions of photodiodes on the board, in mm
+     * @param [in] weights - confidence [0,1] of each entry of pos2D. entries
+     *   with weight 0 are not used
+     * @returns false if the measurements are inconsistent with the state
+     *   (outlier or diverged filter), in which case the state is not changed
+     */
+    bool correct(double pos2D[8], double posRef[8], double weights[8]);
+
+    /** true once the filter was initialized with reset() */
+    bool isValid() const { return valid; };
+
+    /** orientation of the board in the base station frame */
+    const Quaternion& getQuaternion() const { return quaternion; };
+
+    /** position of the board in the base station frame, in mm */
+    const double * getPosition() const { return position; };
+
+    /** velocity of the board in the base station frame, in mm/s */
+    const double * getVelocity() const { return velocity; };
+
+    /** residual gyro bias in rad/s, in the IMU frame */
+    const double * getGyrBias() const { return gyrBias; };
+
+    /** std. dev. of the gyro noise, in rad/s/sqrt(Hz) */
+    double gyrNoise = 0.003;
+
+    /** std. dev. of the acceleration noise (incl. unmodeled acc bias), in mm/s^2/sqrt(Hz) */
+    double accNoise = 500;
+
+    /** std. dev. of the gyro bias random walk, in rad/s/sqrt(s) */
+    double gyrBiasNoise = 0.0001;
+
+    /** std. dev. of the 2D projections of a diode with confidence 1 */
+    double pos2DNoise = 0.0005;
+
+    /**
+     * corrections are rejected if the normalized innovation squared is
+     * larger (chi^2 with up to 8 degrees of freedom)
+     */
+    double maxInnovation = 40;
+
+  protected:
+
+    /** M = Phi * M, with the sparse transition matrix of the current step */
+    void multiplyTransition(double M[12][12]);
+
+    /** true once the filter was initialized */
+    bool valid;
+
+    /** orientation of the board in the base station frame */
+    Quaternion quaternion;
+
+    /** position in mm */
+    double position[3];
+
+    /** velocity in mm/s */
+    double velocity[3];
+
+    /** residual gyro bias in rad/s, in the IMU frame */
+    double gyrBias[3];
+
+    /** unit up vector in the base station frame */
+    double up[3];
+
+    /** error state covariance */
+    double P[12][12];
+
+    /**
+     * non-trivial blocks of the transition matrix of the current step:
+     * rotation error w.r.t. gyro bias error (-R dt) and
+     * velocity error w.r.t. rotation error (-[R acc]x dt)
+     */
+    double PhiRotBias[3][3];
+    double PhiVelRot[3][3];
+
+    /** time step of the current transition matrix, in s */
+    double PhiDeltaT;
+
+};
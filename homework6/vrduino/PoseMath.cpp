@@ -1,25 +1,119 @@
 #include "PoseMath.h"
 
+/**
+ * difference between the measured and the ideal sweep angle of a rotor,
+ * see BaseStationCalibration
+ * @param [in] axis - 0: horizontal, 1: vertical
+ * @param [in] angle - ideal sweep angle in radians
+ * @param [in] other - normalized coordinate of the other axis
+ */
+static double getSweepAngleCorrection(const BaseStationCalibration *calibration, int axis,
+  double angle, double other) {
+  return calibration->phase[axis] + tan(calibration->tilt[axis]) * other +
+    calibration->curve[axis] * other * other +
+    calibration->gibMag[axis] * sin(angle + calibration->gibPhase[axis]);
+}
+
 /**
  * TODO: see header file for documentation
  */
-void convertTicksTo2DPositions(uint32_t clockTicks[8], double pos2D[8])
+void convertTicksTo2DPositions(uint32_t clockTicks[8], double pos2D[8],
+  const BaseStationCalibration *calibration, double rotorPeriod)
 {
-  // Compute relative times between sync pulse and sweeps
+  if (rotorPeriod <= 0)
+    rotorPeriod = (double) CLOCKS_PER_SECOND / 60;
+
+  // Compute relative times between sync pulse and sweeps, in rotor revolutions
   double relativeTimes[8];
   for (int i = 0; i < 8; i++)
-    relativeTimes[i] = ((double) clockTicks[i]) / CLOCKS_PER_SECOND;
+    relativeTimes[i] = ((double) clockTicks[i]) / rotorPeriod;
   
   // Compute horizontal and vertical angles (in degrees)
   double angles[8];
   for (int i = 0; i < 8; i += 2)  // horizontal
-    angles[i] = -relativeTimes[i] * 60 * 360 + 90;
+    angles[i] = -relativeTimes[i] * 360 + 90;
   for (int i = 1; i < 8; i += 2)  // vertical
-    angles[i] = relativeTimes[i] * 60 * 360 - 90;
+    angles[i] = relativeTimes[i] * 360 - 90;
 
   // Compute 2D normalized coordinates
   for (int i = 0; i < 8; i++)
     pos2D[i] = tan(radians(angles[i]));
+
+  if (calibration == NULL || !calibration->valid)
+    return;
+
+  // Remove the factory calibration. The correction of one axis depends on the
+  // coordinate of the other one, so iterate. The corrections are small, two
+  // iterations are enough.
+  for (int iteration = 0; iteration < 2; iteration++) {
+    double corrected[8];
+    for (int i = 0; i < 8; i++) {
+      int axis = i & 1;
+      double measured = radians(angles[i]);
+      double angle = atan(pos2D[i]);
+      corrected[i] = tan(measured -
+        getSweepAngleCorrection(calibration, axis, angle, pos2D[i ^ 1]));
+    }
+    for (int i = 0; i < 8; i++)
+      pos2D[i] = corrected[i];
+  }
+}
+
+/**
+ * see header file for documentation
+ */
+bool predictSweepTicks(Quaternion& q, double pos3D[3], double posRef[8],
+  double clockTicks[8], const BaseStationCalibration *calibration, double rotorPeriod) {
+
+  if (rotorPeriod <= 0)
+    rotorPeriod = (double) CLOCKS_PER_SECOND / 60;
+
+  for (int i = 0; i < 4; i++) {
+    double diode[3] = {posRef[2 * i], posRef[2 * i + 1], 0};
+    double p[3];
+    rotateVector(q, diode, p);
+    for (int j = 0; j < 3; j++)
+      p[j] += pos3D[j];
+
+    // base station looks down the negative z-axis
+    if (p[2] >= 0) return false;
+
+    // angles of the projection (in degrees), inverse of convertTicksTo2DPositions
+    double u = p[0] / -p[2];
+    double v = p[1] / -p[2];
+    double angleH = atan(u);
+    double angleV = atan(v);
+    if (calibration != NULL && calibration->valid) {
+      double correctionH = getSweepAngleCorrection(calibration, 0, angleH, v);
+      double correctionV = getSweepAngleCorrection(calibration, 1, angleV, u);
+      angleH += correctionH;
+      angleV += correctionV;
+    }
+    angleH = degrees(angleH);
+    angleV = degrees(angleV);
+    clockTicks[2 * i] = (90 - angleH) / 360 * rotorPeriod;
+    clockTicks[2 * i + 1] = (angleV + 90) / 360 * rotorPeriod;
+  }
+
+  return true;
+}
+
+/**
+ * see header file for documentation
+ */
+double computeDiodeConfidence(unsigned long numDetections, unsigned long pulseWidth,
+  unsigned long pulseDifference, unsigned long minPulseWidth, unsigned long maxPulseDifference) {
+
+  if (numDetections == 0) return 0;
+
+  double confidence = 1;
+  if (pulseWidth < minPulseWidth)
+    confidence *= (double) pulseWidth / minPulseWidth;
+
+  if (numDetections > 1 && pulseDifference > maxPulseDifference)
+    confidence *= (double) maxPulseDifference / pulseDifference;
+
+  return confidence;
 }
 
 /**
@@ -93,6 +187,174 @@ void getRtFromH(double h[8], double ROut[3][3], double pos3DOut[3]) {
 
 
 
+/**
+ * see header file for documentation
+ */
+bool solveWithOrientationPrior(double pos2D[8], bool valid[8], double posRef[8],
+  double up[3], bool estimateYaw, Quaternion& q, double pos3DOut[3]) {
+
+  // unknowns: tx, ty, tz and the yaw angle
+  int n = estimateYaw ? 4 : 3;
+
+  int nValid = 0;
+  for (int i = 0; i < 8; i++)
+    if (valid[i]) nValid++;
+  if (nValid < n) return false;
+
+  // the yaw is linearized, iterate once more to refine it
+  int nIterations = estimateYaw ? 2 : 1;
+
+  for (int iteration = 0; iteration < nIterations; iteration++) {
+
+    // normal equations AtA x = Atb
+    double AtA[4][4] = {{0}};
+    double Atb[4] = {0};
+
+    for (int i = 0; i < 8; i++) {
+      if (!valid[i]) continue;
+
+      double diode[3] = {posRef[i & ~1], posRef[i | 1], 0};
+      double r[3];
+      rotateVector(q, diode, r);
+
+      // derivative of r w.r.t. the yaw angle: up x r
+      double dr[3] = {up[1] * r[2] - up[2] * r[1],
+                      up[2] * r[0] - up[0] * r[2],
+                      up[0] * r[1] - up[1] * r[0]};
+
+      // u = (r_x + t_x) / -(r_z + t_z), rearranged to be linear in t
+      int axis = i & 1;
+      double u = pos2D[i];
+      double a[4] = {0, 0, u, dr[axis] + u * dr[2]};
+      a[axis] = 1;
+      double b = -r[axis] - u * r[2];
+
+      for (int j = 0; j < n; j++) {
+        for (int k = 0; k < n; k++)
+          AtA[j][k] += a[j] * a[k];
+        Atb[j] += a[j] * b;
+      }
+    }
+
+    // AtA is stored with a stride of 4, copy it to a dense n x n matrix
+    double M[16];
+    for (int j = 0; j < n; j++)
+      for (int k = 0; k < n; k++)
+        M[j * n + k] = AtA[j][k];
+
+    if (not Matrix.Invert(M, n)) return false;
+    double x[4];
+    Matrix.Multiply(M, Atb, n, n, 1, x);
+
+    for (int j = 0; j < 3; j++)
+      pos3DOut[j] = x[j];
+
+    if (estimateYaw) {
+      Quaternion qYaw = Quaternion().setFromAngleAxis(degrees(x[3]), up[0], up[1], up[2]);
+      q = Quaternion().multiply(qYaw, q).normalize();
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * see header file for documentation
+ */
+bool getReprojectionJacobian(double pos2D[8], double posRef[8], Quaternion& q,
+  double pos3D[3], double residual[8], double J[8][6]) {
+
+  for (int i = 0; i < 4; i++) {
+    double diode[3] = {posRef[2 * i], posRef[2 * i + 1], 0};
+    double r[3];
+    rotateVector(q, diode, r);
+    double p[3] = {r[0] + pos3D[0], r[1] + pos3D[1], r[2] + pos3D[2]};
+
+    double w = -p[2];
+    if (w <= 0) return false;
+
+    // d(theta x r)/d(theta) = -[r]x
+    double dRot[3][3] = {{    0,  r[2], -r[1]},
+                         {-r[2],     0,  r[0]},
+                         { r[1], -r[0],     0}};
+
+    for (int axis = 0; axis < 2; axis++) {
+      int row = 2 * i + axis;
+      residual[row] = pos2D[row] - p[axis] / w;
+
+      // derivative of the projection p[axis] / -p[2] w.r.t. p
+      double dp[3] = {0, 0, p[axis] / sq(w)};
+      dp[axis] = 1 / w;
+
+      for (int j = 0; j < 3; j++) {
+        J[row][j] = dp[0] * dRot[0][j] + dp[1] * dRot[1][j] + dp[2] * dRot[2][j];
+        J[row][j + 3] = dp[j];
+      }
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * see header file for documentation
+ */
+bool refinePose(double pos2D[8], double posRef[8], double weights[8], int nIterations,
+  Quaternion& q, double pos3D[3], double& errorOut) {
+
+  double residual[8];
+  double J[8][6];
+
+  for (int iteration = 0; iteration < nIterations; iteration++) {
+
+    if (not getReprojectionJacobian(pos2D, posRef, q, pos3D, residual, J)) return false;
+
+    // normal equations JtWJ x = JtWr
+    double JtJ[6][6] = {{0}};
+    double Jtr[6] = {0};
+    for (int i = 0; i < 8; i++) {
+      for (int j = 0; j < 6; j++) {
+        double wJ = weights[i] * J[i][j];
+        for (int k = j; k < 6; k++)
+          JtJ[j][k] += wJ * J[i][k];
+        Jtr[j] += wJ * residual[i];
+      }
+    }
+    for (int j = 0; j < 6; j++)
+      for (int k = 0; k < j; k++)
+        JtJ[j][k] = JtJ[k][j];
+
+    if (not Matrix.Invert((double *) JtJ, 6)) return false;
+    double x[6];
+    Matrix.Multiply((double *) JtJ, Jtr, 6, 6, 1, x);
+
+    // apply the rotation in the base station frame
+    double angle = sqrt(sq(x[0]) + sq(x[1]) + sq(x[2]));
+    if (angle > 0) {
+      Quaternion dq = Quaternion().setFromAngleAxis(degrees(angle),
+        x[0] / angle, x[1] / angle, x[2] / angle);
+      q = Quaternion().multiply(dq, q).normalize();
+    }
+    for (int j = 0; j < 3; j++)
+      pos3D[j] += x[j + 3];
+  }
+
+  if (not getReprojectionJacobian(pos2D, posRef, q, pos3D, residual, J)) return false;
+
+  double sumError = 0;
+  double sumWeights = 0;
+  for (int i = 0; i < 8; i++) {
+    sumError += weights[i] * sq(residual[i]);
+    sumWeights += weights[i];
+  }
+  errorOut = (sumWeights > 0) ? sqrt(sumError / sumWeights) : 0;
+
+  return true;
+}
+
+
 /**
  * TODO: see header file for documentation
  */
@@ -103,3 +365,72 @@ Quaternion getQuaternionFromRotationMatrix(double R[3][3]) {
   double qZ = (R[1][0] - R[0][1]) / (4 * qW);
   return Quaternion(qW, qX, qY, qZ);
 }
+
+
+/**
+ * see header file for documentation
+ */
+void rotateVector(Quaternion& q, double v[3], double vOut[3]) {
+  Quaternion qv = Quaternion(0, v[0], v[1], v[2]).rotate(q);
+  vOut[0] = qv.q[1];
+  vOut[1] = qv.q[2];
+  vOut[2] = qv.q[3];
+}
+
+
+/**
+ * see header file for documentation
+ */
+void getUpFromPitchRoll(double pitch, double roll, double upOut[3]) {
+  // inverse of the pitch and roll computation in LighthouseOOTX
+  upOut[0] = cos(radians(pitch)) * sin(radians(roll));
+  upOut[1] = cos(radians(pitch)) * cos(radians(roll));
+  upOut[2] = -sin(radians(pitch));
+}
+
+
+/**
+ * see header file for documentation
+ */
+Quaternion getLevelingQuaternion(double pitch, double roll) {
+
+  // rotate the up vector onto the y-axis, about up x y
+  double up[3];
+  getUpFromPitchRoll(pitch, roll, up);
+
+  double normAxis = sqrt(sq(up[0]) + sq(up[2]));
+  if (normAxis < 1e-8) {
+    return Quaternion();
+  }
+
+  double angle = degrees(atan2(normAxis, up[1]));
+  return Quaternion().setFromAngleAxis(angle, -up[2] / normAxis, 0, up[0] / normAxis);
+
+}
+
+
+/**
+ * see header file for documentation
+ */
+void composePose(Quaternion& qA, double tA[3], Quaternion& qB, double tB[3],
+  Quaternion& qOut, double tOut[3]) {
+  double tBRotated[3];
+  rotateVector(qA, tB, tBRotated);
+  for (int i = 0; i < 3; i++)
+    tOut[i] = tBRotated[i] + tA[i];
+  qOut = Quaternion().multiply(qA, qB).normalize();
+}
+
+
+/**
+ * see header file for documentation
+ */
+void getRelativePose(Quaternion& qA, double tA[3], Quaternion& qB, double tB[3],
+  Quaternion& qOut, double tOut[3]) {
+  Quaternion qBInv = qB.clone().inverse();
+  qOut = Quaternion().multiply(qA, qBInv).normalize();
+  double tBRotated[3];
+  rotateVector(qOut, tB, tBRotated);
+  for (int i = 0; i < 3; i++)
+    tOut[i] = tA[i] - tBRotated[i];
+}
@@ -7,6 +7,7 @@
 #include <Wire.h>
 #include "MatrixMath.h"
 #include "Quaternion.h"
+#include "LighthouseOOTX.h"
 
 
 #if defined(KINETISK)
@@ -26,8 +27,57 @@
  *  for each of the 4 photodiodes
  * @param [out] pos2D positions of measurements on plane at
  *   unit distance
+ * @param [in] calibration - factory calibration of the base station from
+ *   the OOTX frame. if given and valid, the sweep angles are corrected for
+ *   it, see BaseStationCalibration in LighthouseOOTX.h
+ * @param [in] rotorPeriod - measured period of one rotor revolution in clock
+ *   ticks. if 0, the nominal period of CLOCKS_PER_SECOND / 60 is used
  */
-void convertTicksTo2DPositions(uint32_t *clockTicks, double *pos2D);
+void convertTicksTo2DPositions(uint32_t *clockTicks, double *pos2D,
+  const BaseStationCalibration *calibration = NULL, double rotorPeriod = 0);
+
+
+/**
+ * predicts the clock ticks of the sweep pulses of each photodiode from a
+ * pose. the photodiodes are projected onto the plane at unit distance and
+ * the projections are converted back to ticks, i.e. this is the inverse
+ * of convertTicksTo2DPositions
+ * @param [in] q - orientation of the board in the base station frame
+ * @param [in] pos3D - position of the board in the base station frame, in mm
+ * @param [in] posRef - 2D positions of photodiodes on the board, in mm
+ * @param [out] clockTicks - predicted ticks since the sync pulse.
+ *   order is sensor0H, sensor0V, ... sensor3H, sensor3V
+ * @param [in] calibration - factory calibration of the base station, if known
+ * @param [in] rotorPeriod - measured rotor period in clock ticks, 0 for nominal
+ * @returns false if a photodiode is not in front of the base station
+ */
+bool predictSweepTicks(Quaternion& q, double pos3D[3], double posRef[8],
+  double clockTicks[8], const BaseStationCalibration *calibration = NULL,
+  double rotorPeriod = 0);
+
+
+/**
+ * confidence that the selected sweep pulse of one diode axis is the
+ * direct hit of the laser and not a reflection or noise.
+ * - 0 if there was no detection
+ * - reduced if the pulse is shorter than minPulseWidth. reflections are
+ *   dimmer and hence narrower than direct hits
+ * - if there were several detections (interreflections), reduced if the
+ *   selected pulse is further than maxPulseDifference from the center of
+ *   the sweep window (the predicted pulse, or the pulse of the previous
+ *   period). a single detection is not penalized, so that tracking can be
+ *   reacquired after an occlusion
+ * @param [in] numDetections - number of sweep pulses in the period
+ * @param [in] pulseWidth - width of the selected pulse in clock ticks
+ * @param [in] pulseDifference - ticks between the selected pulse and the
+ *   center of the sweep window
+ * @param [in] minPulseWidth - width in ticks below which confidence drops
+ * @param [in] maxPulseDifference - difference in ticks above which
+ *   confidence drops
+ * @returns confidence in [0,1]
+ */
+double computeDiodeConfidence(unsigned long numDetections, unsigned long pulseWidth,
+  unsigned long pulseDifference, unsigned long minPulseWidth, unsigned long maxPulseDifference);
 
 
 /**
@@ -69,6 +119,66 @@ bool solveForH(double A[8][8], double b[8], double hOut[8]);
 void getRtFromH(double h[8], double ROut[3][3], double pos3DOut[3]);
 
 
+/**
+ * estimates the position from a subset of the photodiode measurements when
+ * the orientation is known, e.g. from the IMU. each measured axis gives one
+ * equation that is linear in the position, and for small angles also in a
+ * rotation about the up axis (yaw), which corrects the drift of the prior.
+ * the equations are solved in the least-squares sense.
+ * @param [in] pos2D - measured 2D projections of the photodiodes on the plane
+ *   at unit distance. order is [sensor0x, sensor0y, ... sensor3x, sensor3y]
+ * @param [in] valid - true for each entry of pos2D that was measured
+ * @param [in] posRef - 2D positions of photodiodes on the board, in mm
+ * @param [in] up - unit up vector in the base station frame
+ * @param [in] estimateYaw - if true, also estimate the rotation about up.
+ *   needs at least 4 valid entries, 5 or more are recommended
+ * @param [in,out] q - orientation prior of the board in the base station
+ *   frame. rotated by the estimated yaw
+ * @param [out] pos3DOut - 3x1 position vector in mm. order is [x,y,z]
+ * @returns false if there are too few valid entries or the system is singular
+ */
+bool solveWithOrientationPrior(double pos2D[8], bool valid[8], double posRef[8],
+  double up[3], bool estimateYaw, Quaternion& q, double pos3DOut[3]);
+
+
+/**
+ * computes the reprojection residuals of the photodiodes and their
+ * derivatives w.r.t. a small rotation of the board in the base station
+ * frame (first 3 columns) and its translation (last 3 columns)
+ * @param [in] pos2D - measured 2D projections of the photodiodes on the plane
+ *   at unit distance. order is [sensor0x, sensor0y, ... sensor3x, sensor3y]
+ * @param [in] posRef - 2D positions of photodiodes on the board, in mm
+ * @param [in] q - orientation of the board in the base station frame
+ * @param [in] pos3D - position of the board in the base station frame, in mm
+ * @param [out] residual - measured minus projected positions, order as pos2D
+ * @param [out] J - 8x6 derivatives of the projected positions
+ * @returns false if a photodiode is behind the base station
+ */
+bool getReprojectionJacobian(double pos2D[8], double posRef[8], Quaternion& q,
+  double pos3D[3], double residual[8], double J[8][6]);
+
+
+/**
+ * refines a pose by minimizing the weighted reprojection error of the
+ * photodiodes with a fixed number of Gauss-Newton steps. the unknowns are a
+ * small rotation of the board in the base station frame and the translation.
+ * converges in one or two steps if started close to the solution, e.g. from
+ * the pose of the previous frame.
+ * @param [in] pos2D - measured 2D projections of the photodiodes on the plane
+ *   at unit distance. order is [sensor0x, sensor0y, ... sensor3x, sensor3y]
+ * @param [in] posRef - 2D positions of photodiodes on the board, in mm
+ * @param [in] weights - weight of each entry of pos2D, e.g. its confidence
+ * @param [in] nIterations - number of Gauss-Newton steps
+ * @param [in,out] q - orientation of the board in the base station frame
+ * @param [in,out] pos3D - 3x1 position vector in mm. order is [x,y,z]
+ * @param [out] errorOut - weighted rms reprojection error after the last step
+ * @returns false if a photodiode is behind the base station or the
+ *   system is singular
+ */
+bool refinePose(double pos2D[8], double posRef[8], double weights[8], int nIterations,
+  Quaternion& q, double pos3D[3], double& errorOut);
+
+
 /**
  * extract a quaternion from a 3x3 rotation matrix
  * follows algorithm here:
@@ -77,3 +187,55 @@ void getRtFromH(double h[8], double ROut[3][3], double pos3DOut[3]);
  * @returns output quaternion
  */
 Quaternion getQuaternionFromRotationMatrix(double R[3][3]);
+
+
+/**
+ * rotates a 3D vector by a unit quaternion: vOut = q * v * q^{-1}
+ * @param [in] q - unit quaternion
+ * @param [in] v - 3x1 input vector
+ * @param [out] vOut - 3x1 rotated vector
+ */
+void rotateVector(Quaternion& q, double v[3], double vOut[3]);
+
+
+/**
+ * gets the up vector in the base station frame from the pitch and roll
+ * of the base station, as reported in its OOTX frame
+ * @param [in] pitch - base station pitch in degrees (rotation about x-axis)
+ * @param [in] roll - base station roll in degrees (rotation about z-axis)
+ * @param [out] upOut - 3x1 unit up vector
+ */
+void getUpFromPitchRoll(double pitch, double roll, double upOut[3]);
+
+
+/**
+ * gets the rotation from the base station frame to a level frame with the
+ * same heading, i.e. with the y-axis pointing up
+ * @param [in] pitch - base station pitch in degrees (rotation about x-axis)
+ * @param [in] roll - base station roll in degrees (rotation about z-axis)
+ * @returns leveling quaternion
+ */
+Quaternion getLevelingQuaternion(double pitch, double roll);
+
+
+/**
+ * composes two rigid transforms, T = TA * TB (TB is applied first):
+ *  qOut = qA * qB, tOut = qA * tB * qA^{-1} + tA
+ * @param [in] qA, tA - rotation and translation of TA
+ * @param [in] qB, tB - rotation and translation of TB
+ * @param [out] qOut, tOut - rotation and translation of T
+ */
+void composePose(Quaternion& qA, double tA[3], Quaternion& qB, double tB[3],
+  Quaternion& qOut, double tOut[3]);
+
+
+/**
+ * gets the rigid transform T that maps TB onto TA, i.e. TA = T * TB.
+ * for two poses of the board, this is the transform between the
+ * two reference frames.
+ * @param [in] qA, tA - rotation and translation of TA
+ * @param [in] qB, tB - rotation and translation of TB
+ * @param [out] qOut, tOut - rotation and translation of T
+ */
+void getRelativePose(Quaternion& qA, double tA[3], Quaternion& qB, double tB[3],
+  Quaternion& qOut, double tOut[3]);
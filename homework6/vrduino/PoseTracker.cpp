@@ -1,38 +1,402 @@
 #include "PoseTracker.h"
 #include <Wire.h>
 
-PoseTracker::PoseTracker(double alphaImuFilterIn, int baseStationModeIn, bool simulateLighthouseIn) :
+PoseTracker::PoseTracker(double alphaImuFilterIn, int baseStationModeIn, bool simulateLighthouseIn,
+  int secondaryBaseStationModeIn) :
 
   OrientationTracker(alphaImuFilterIn, false),
   lighthouse(),
   simulateLighthouse(simulateLighthouseIn),
   simulateLighthouseCounter(0),
   position{0,0,-500},
-  baseStationPitch(0),
-  baseStationRoll(0),
-  baseStationMode(baseStationModeIn),
-  position2D{0,0,0,0,0,0,0,0},
-  clockTicks{0,0,0,0,0,0,0,0},
-  numPulseDetections{0,0,0,0,0,0,0,0},
-  pulseWidth{0,0,0,0,0,0,0,0}
+  quaternionHm(),
+  poseTimestamp(0),
+  station{Station(baseStationModeIn), Station(secondaryBaseStationModeIn)},
+  baseStationPosition{0,0,0},
+  baseStationQuaternion(),
+  baseStationPositionSum{0,0,0},
+  baseStationQuaternionSum{0,0,0,0},
+  nBaseStationSamples(0),
+  nValidPoses(0),
+  nStrictPoses(0),
+  validPoseRate(0),
+  strictPoseRate(0),
+  poseRateWindowStart(0),
+  ekf(),
+  ekfEnabled(false),
+  nEkfRejections(0),
+  positionFilterEnabled(false),
+  positionFilterValid(false),
+  positionComp{0,0,-500},
+  velocityComp{0,0,0},
+  positionFilterTime(0),
+  positionFilterCycles(),
+  ekfCycles(),
+  orientationReferenceEnabled(false),
+  orientationReferenceYawOnly(true),
+  hasReferenceOffset(false),
+  referenceOffset()
 
   {
 
 }
 
+void PoseTracker::setMode(int mode) {
+
+  clearSweepWindows();
+
+  if (mode == station[1].mode) {
+    station[1].mode = station[0].mode;
+  }
+  station[0].mode = mode;
+  station[0].hasPose = false;
+  station[1].hasPose = false;
+  resetBaseStationTransform();
+
+  //the pose of the filters is in the frame of the primary station
+  ekf = PoseEkf();
+  positionFilterValid = false;
+  hasReferenceOffset = false;
+
+}
+
+void PoseTracker::setSecondaryMode(int mode) {
+
+  clearSweepWindows();
+
+  station[1].mode = (mode == station[0].mode) ? -1 : mode;
+  station[1].hasPose = false;
+  resetBaseStationTransform();
+
+}
+
+void PoseTracker::resetBaseStationTransform() {
+
+  for (int i = 0; i < 3; i++) {
+    baseStationPositionSum[i] = 0;
+  }
+  for (int i = 0; i < 4; i++) {
+    baseStationQuaternionSum[i] = 0;
+  }
+  nBaseStationSamples = 0;
+
+}
+
 int PoseTracker::processLighthouse() {
 
+  int result[2] = {-2, -2};
+
+  if (!simulateLighthouse) {
+    lighthouse.processOOTX();
+  }
+
+  result[0] = processStation(station[0]);
+
+  //the simulated data only contains timings of one station
+  if (!simulateLighthouse && station[1].mode >= 0) {
+    result[1] = processStation(station[1]);
+  }
+
+  bool updated[2] = {result[0] == 1, result[1] == 1};
+
+  //partially occluded frames that are not solved still correct the EKF
+  //with the diodes that have a plausible detection
+  if (ekfEnabled && result[0] > -2) {
+    updateEkf(updated[0]);
+  }
+
+  if (!simulateLighthouse && micros() - sweepWindowTime >= sweepWindowPeriod) {
+    sweepWindowTime = micros();
+    for (int i = 0; i < 2; i++) {
+      if (station[i].mode >= 0) {
+        updateSweepWindows(station[i]);
+      }
+    }
+  }
+
+  if (updated[0] || updated[1]) {
+
+    updateBaseStationTransform();
+
+    bool valid = fuseStationPoses(updated);
+
+    if (valid) {
+      //the time of the most recent data that went into the pose
+      poseTimestamp = 0;
+      for (int i = 0; i < 2; i++) {
+        if (updated[i] && station[i].timestamp > poseTimestamp) {
+          poseTimestamp = station[i].timestamp;
+        }
+      }
+    }
+
+    if (positionFilterEnabled && valid) {
+      correctPositionFilter();
+    }
+
+    updatePoseRates(valid, (updated[0] && station[0].singleDetections) ||
+      (updated[1] && station[1].singleDetections && isBaseStationTransformValid()));
+
+    return valid ? 1 : 0;
+
+  }
+
+  updatePoseRates(false, false);
+
+  return max(result[0], result[1]);
+
+}
+
+bool PoseTracker::processImu() {
+
+  if (!OrientationTracker::processImu()) {
+    return false;
+  }
+
+  if (positionFilterEnabled) {
+    uint32_t startCycles = getCycleCount();
+    propagatePositionFilter();
+    positionFilterCycles.add(getCycleCount() - startCycles);
+  }
+
+  if (ekfEnabled) {
+    uint32_t startCycles = getCycleCount();
+    ekf.propagate(gyr, acc, deltaT);
+    ekfCycles.add(getCycleCount() - startCycles);
+  }
+
+  return true;
+
+}
+
+void PoseTracker::resetCycleStats() {
+
+  OrientationTracker::resetCycleStats();
+  positionFilterCycles.reset();
+  ekfCycles.reset();
+
+}
+
+void PoseTracker::setPositionFilterEnabled(bool enabled) {
+
+  positionFilterEnabled = enabled;
+  positionFilterValid = false;
+
+}
+
+bool PoseTracker::predictPose(double dtAhead, Quaternion& qOut, double posOut[3]) {
+
+  const double * pos;
+  const double * vel;
+  double gyrPredict[3] = {gyr[0], gyr[1], gyr[2]};
+  if (isEkfValid()) {
+    qOut = ekf.getQuaternion();
+    pos = ekf.getPosition();
+    vel = ekf.getVelocity();
+    //the EKF propagates with the gyro minus its estimate of the residual bias
+    for (int i = 0; i < 3; i++) {
+      gyrPredict[i] -= degrees(ekf.getGyrBias()[i]);
+    }
+  } else if (isPositionFilterValid() && station[0].hasPose) {
+    double up[3];
+    qOut = predictQuaternion(station[0], up);
+    pos = positionComp;
+    vel = velocityComp;
+  } else {
+    return false;
+  }
+
+  //the angular velocity is in the IMU frame, i.e. applied from the right
+  if (dtAhead > 0) {
+    updateQuaternionGyr(qOut, gyrPredict, dtAhead);
+  }
+  for (int i = 0; i < 3; i++) {
+    posOut[i] = pos[i] + vel[i] * dtAhead;
+  }
+
+  return true;
+
+}
+
+void PoseTracker::setOrientationReference(bool enabled, bool yawOnly) {
+
+  orientationReferenceEnabled = enabled;
+  orientationReferenceYawOnly = yawOnly;
+  hasReferenceOffset = false;
+
+}
+
+void PoseTracker::applyOrientationReference(Station& s) {
+
+  //the station pitch and roll are known once its OOTX frame is decoded.
+  //the calibration can be valid before, from the cache
+  if (!lighthouse.isOOTXInfoAvailable(s.mode)) {
+    return;
+  }
+
+  //orientation of the board in a level frame with the heading of the station
+  Quaternion level = getLevelingQuaternion(s.pitch, s.roll);
+  Quaternion qRef = Quaternion().multiply(level, s.quaternionHm);
+
+  //the heading of the IMU world frame is arbitrary, keep the one at the
+  //first reference
+  if (!hasReferenceOffset) {
+    Quaternion qRefInv = qRef.clone().inverse();
+    Quaternion offset = Quaternion().multiply(quaternionComp, qRefInv);
+    double norm = sqrt(sq(offset.q[0]) + sq(offset.q[2]));
+    referenceOffset = (norm >= 1e-8) ?
+      Quaternion(offset.q[0] / norm, 0, offset.q[2] / norm, 0) : Quaternion();
+    hasReferenceOffset = true;
+  }
+  qRef = Quaternion().multiply(referenceOffset, qRef);
+
+  Quaternion correction = updateOrientationReference(qRef, orientationReferenceYawOnly);
+
+  //the correction rotates the IMU world frame, rotate the orientations
+  //the stations were aligned with too
+  for (int i = 0; i < 2; i++) {
+    station[i].quaternionImu = Quaternion().multiply(correction, station[i].quaternionImu);
+  }
+
+}
+
+void PoseTracker::propagatePositionFilter() {
+
+  //needs the alignment of the IMU with the primary station
+  if (!positionFilterValid || !station[0].hasPose) {
+    return;
+  }
+
+  double up[3];
+  Quaternion q = predictQuaternion(station[0], up);
+
+  //magnitude of gravity as measured by the acc at rest, in mm/s^2
+  double gravity = 1000 * sqrt(sq(accBias[0]) + sq(accBias[1]) + sq(accBias[2]));
+  if (gravity == 0) {
+    gravity = 9806.65;
+  }
+
+  double accMm[3] = {1000 * acc[0], 1000 * acc[1], 1000 * acc[2]};
+  double a[3];
+  rotateVector(q, accMm, a);
+
+  for (int i = 0; i < 3; i++) {
+    a[i] -= gravity * up[i];
+    positionComp[i] += velocityComp[i] * deltaT + 0.5 * a[i] * sq(deltaT);
+    velocityComp[i] += a[i] * deltaT;
+  }
+
+}
+
+void PoseTracker::correctPositionFilter() {
+
+  double error[3];
+  for (int i = 0; i < 3; i++) {
+    error[i] = position[i] - positionComp[i];
+  }
+  double errorNorm = sqrt(sq(error[0]) + sq(error[1]) + sq(error[2]));
+
+  //time since the previous correction, for gains independent of the frame rate
+  double dt = (poseTimestamp > positionFilterTime) ?
+    InputCapture::ticksToSeconds(poseTimestamp - positionFilterTime) : 0;
+  dt = min(dt, maxPositionFilterStep);
+  positionFilterTime = poseTimestamp;
+
+  if (!positionFilterValid || errorNorm > maxPositionFilterError) {
+    for (int i = 0; i < 3; i++) {
+      positionComp[i] = position[i];
+      velocityComp[i] = 0;
+    }
+    positionFilterValid = true;
+    return;
+  }
+
+  double positionAlpha = 1 - exp(-positionFilterGain * dt);
+  for (int i = 0; i < 3; i++) {
+    positionComp[i] += positionAlpha * error[i];
+    velocityComp[i] += velocityFilterGain * dt * error[i];
+  }
+
+}
+
+void PoseTracker::setEkfEnabled(bool enabled) {
+
+  //start from the next pose
+  ekf = PoseEkf();
+  ekfEnabled = enabled;
+  nEkfRejections = 0;
+
+}
+
+void PoseTracker::updateEkf(bool solved) {
+
+  Station& s = station[0];
+
+  double up[3];
+  getUpFromPitchRoll(s.pitch, s.roll, up);
+  ekf.setUp(up);
+
+  //only use diodes with a plausible detection
+  double weights[8];
+  for (int i = 0; i < 8; i++) {
+    weights[i] = (s.confidence[i] >= minDiodeConfidence) ? s.confidence[i] : 0;
+  }
+
+  if (ekf.isValid() && ekf.correct(s.position2D, positionRef, weights)) {
+    nEkfRejections = 0;
+    return;
+  }
+
+  //start over from the lighthouse pose if the filter is not initialized,
+  //or does not agree with the lighthouse anymore. only a solved frame
+  //has a pose
+  if (!solved) {
+    return;
+  }
+  nEkfRejections++;
+  if (!ekf.isValid() || nEkfRejections > maxEkfRejections) {
+    ekf.reset(s.quaternionHm, s.position);
+    nEkfRejections = 0;
+  }
+
+}
+
+void PoseTracker::updatePoseRates(bool valid, bool singleDetections) {
+
+  unsigned long now = micros();
+  if (now - poseRateWindowStart >= 1000000) {
+    validPoseRate = nValidPoses;
+    strictPoseRate = nStrictPoses;
+    nValidPoses = 0;
+    nStrictPoses = 0;
+    poseRateWindowStart = now;
+  }
+
+  if (valid) {
+    nValidPoses++;
+    if (singleDetections) {
+      nStrictPoses++;
+    }
+  }
+
+}
+
+int PoseTracker::processStation(Station& s) {
+
   if (simulateLighthouse) {
   //if in simulation mode, get data from external file
     for (int i = 0; i < 8; i++) {
-      clockTicks[i] = clockTicksData[(simulateLighthouseCounter*8 + i) % nLighthouseSamples];
-      numPulseDetections[i] = 0;
+      s.clockTicks[i] = clockTicksData[(simulateLighthouseCounter*8 + i) % nLighthouseSamples];
+      s.numPulseDetections[i] = 0;
+      s.confidence[i] = 1;
     }
+    s.singleDetections = true;
+    s.timestamp = InputCapture::now();
 
     //base station pitch/roll values remain the same throughout the simulation
     if (simulateLighthouseCounter == 0) {
-      baseStationPitch = baseStationPitchSim;
-      baseStationRoll = baseStationRollSim;
+      s.pitch = baseStationPitchSim;
+      s.roll = baseStationRollSim;
     }
 
     //data wraps around after end of array is reached
@@ -43,52 +407,287 @@ int PoseTracker::processLighthouse() {
 
   } else {
     //check data is available
-    if (!lighthouse.readTimings(baseStationMode, clockTicks, numPulseDetections, pulseWidth,
-      baseStationPitch, baseStationRoll)) {
+    if (!lighthouse.readTimings(s.mode, s.clockTicks, s.numPulseDetections, s.pulseWidth,
+      s.pulseDifference, s.pitch, s.roll, s.timestamp)) {
       return -2;
     }
 
-    //check that all diodes have only one detection
+    lighthouse.getCalibration(s.mode, s.calibration);
+    s.rotorPeriod = lighthouse.getRotorPeriod(s.mode);
+
     //the number of dectections could be more than one due to reflections.
+    //the ISR selects the pulse closest to the predicted one, or to the one
+    //of the previous period; use it if it is plausible.
+    s.singleDetections = true;
     for (int i = 0; i < 8; i++) {
-      if (numPulseDetections[i] != 1) {
-        return -1;
+      s.confidence[i] = computeDiodeConfidence(s.numPulseDetections[i], s.pulseWidth[i],
+        s.pulseDifference[i], minSweepPulseWidth, maxSweepPulseDifference);
+      if (s.numPulseDetections[i] != 1) {
+        s.singleDetections = false;
       }
     }
   }
 
-  return updatePose();
+  bool valid[8];
+  int nValid = 0;
+  for (int i = 0; i < 8; i++) {
+    valid[i] = s.confidence[i] >= minDiodeConfidence;
+    if (valid[i]) {
+      nValid++;
+    }
+  }
+
+  int result = -1;
+  if (nValid == 8) {
+    result = updatePose(s);
+    if (result == 1 && &s == &station[0] && orientationReferenceEnabled) {
+      applyOrientationReference(s);
+    }
+  } else if (nValid >= minPriorSolveAxes && s.hasPose) {
+    //partially occluded: use the IMU orientation as prior
+    result = updatePoseWithPrior(s, valid, nValid);
+  } else if (nValid > 0) {
+    //too few diodes to solve, but they can correct the EKF
+    convertTicksTo2DPositions(s.clockTicks, s.position2D, &s.calibration, s.rotorPeriod);
+  }
+
+  //occluded diodes have no 2D position, mark them with NAN for the host
+  for (int i = 0; i < 8; i++) {
+    if (!valid[i]) {
+      s.position2D[i] = NAN;
+    }
+  }
+
+  return result;
 
 }
 
 /**
  * TODO: see header file for documentation
  */
-int PoseTracker::updatePose() {
+int PoseTracker::updatePose(Station& s) {
 
   // call functions in PoseMath.cpp to get a new position
   // and orientation estimate.
   //
-  // you will need to use the following class variables:
-  // - clockTicks
-  // - position2D
+  // you will need to use the following variables:
+  // - s.clockTicks
+  // - s.position2D
   // - positionRef
-  // - position
-  // - quaternionHm
+  // - s.position
+  // - s.quaternionHm
   //
-  // - position and quaternionHm should hold the your position
+  // - s.position and s.quaternionHm should hold the your position
   // and orientation estimates at the end of this function
   //
   // return 0 if errors occur, return 1 if successful
 
-  convertTicksTo2DPositions(clockTicks, position2D);
-  double A[8][8];
-  formA(position2D, positionRef, A);
-  double h[8];
-  if (not solveForH(A, position2D, h)) return false;
-  double R[3][3];
-  getRtFromH(h, R, position);
-  quaternionHm = getQuaternionFromRotationMatrix(R);
-  
+  convertTicksTo2DPositions(s.clockTicks, s.position2D, &s.calibration, s.rotorPeriod);
+
+  //warm start from the last pose
+  bool refined = false;
+  if (s.hasPose && micros() - s.poseTime < maxSweepPredictionAge) {
+    double up[3];
+    Quaternion q = predictQuaternion(s, up);
+    double pos[3] = {s.position[0], s.position[1], s.position[2]};
+    double error;
+    if (refinePose(s.position2D, positionRef, s.confidence, nRefineIterations, q, pos, error) &&
+      error < maxReprojectionError) {
+      s.quaternionHm = q;
+      for (int i = 0; i < 3; i++) {
+        s.position[i] = pos[i];
+      }
+      refined = true;
+    }
+  }
+
+  //cold start from the homography
+  if (!refined) {
+    double A[8][8];
+    formA(s.position2D, positionRef, A);
+    double h[8];
+    if (not solveForH(A, s.position2D, h)) return false;
+    double R[3][3];
+    getRtFromH(h, R, s.position);
+    s.quaternionHm = getQuaternionFromRotationMatrix(R);
+  }
+
+  s.poseTime = micros();
+  s.hasPose = true;
+  s.quaternionImu = quaternionComp;
+
+  return 1;
+}
+
+int PoseTracker::updatePoseWithPrior(Station& s, bool valid[8], int nValid) {
+
+  convertTicksTo2DPositions(s.clockTicks, s.position2D, &s.calibration, s.rotorPeriod);
+
+  double up[3];
+  Quaternion q = predictQuaternion(s, up);
+  if (not solveWithOrientationPrior(s.position2D, valid, positionRef, up,
+    nValid >= minPriorYawAxes, q, s.position)) return 0;
+  s.quaternionHm = q;
+
+  s.poseTime = micros();
+  s.hasPose = true;
+  s.quaternionImu = quaternionComp;
+
   return 1;
+
+}
+
+Quaternion PoseTracker::predictQuaternion(Station& s, double upOut[3]) {
+
+  //the station frame is fixed in the world, so the alignment of the IMU
+  //frame with the station frame is the same as at the last pose
+  Quaternion imuInv = s.quaternionImu.clone().inverse();
+  Quaternion align = Quaternion().multiply(s.quaternionHm, imuInv);
+
+  double up[3] = {0, 1, 0};
+  rotateVector(align, up, upOut);
+
+  return Quaternion().multiply(align, quaternionComp).normalize();
+
+}
+
+void PoseTracker::updateSweepWindows(Station& s) {
+
+  //a prediction from an old pose would reject the direct hits
+  bool recent = s.hasPose && (micros() - s.poseTime < maxSweepPredictionAge);
+
+  double up[3];
+  Quaternion q = predictQuaternion(s, up);
+
+  double ticks[8];
+  if (!recent || !predictSweepTicks(q, s.position, positionRef, ticks, &s.calibration,
+    s.rotorPeriod)) {
+    if (s.sweepGated) {
+      lighthouse.clearSweepWindows(s.mode);
+      s.sweepGated = false;
+    }
+    return;
+  }
+
+  //the windows may start before the sync pulse, the ISR compares modulo 2^32
+  unsigned long windowStart[8];
+  unsigned long windowWidth[8];
+  for (int i = 0; i < 8; i++) {
+    windowStart[i] = (unsigned long)ticks[i] - sweepWindowHalfWidth;
+    windowWidth[i] = 2 * sweepWindowHalfWidth;
+  }
+
+  s.sweepGated = lighthouse.setSweepWindows(s.mode, windowStart, windowWidth);
+
+}
+
+void PoseTracker::clearSweepWindows() {
+
+  for (int i = 0; i < 2; i++) {
+    if (station[i].sweepGated) {
+      lighthouse.clearSweepWindows(station[i].mode);
+      station[i].sweepGated = false;
+    }
+  }
+
+}
+
+void PoseTracker::updateBaseStationTransform() {
+
+  //the transform is only estimated once
+  if (isBaseStationTransformValid() || !station[0].hasPose || !station[1].hasPose) {
+    return;
+  }
+
+  //the board must not have moved much between the two poses
+  unsigned long dt = (station[0].poseTime > station[1].poseTime) ?
+    station[0].poseTime - station[1].poseTime : station[1].poseTime - station[0].poseTime;
+  if (dt > maxStationTimeOffset) {
+    return;
+  }
+
+  //transform from the secondary into the primary station frame
+  Quaternion q;
+  double t[3];
+  getRelativePose(station[0].quaternionHm, station[0].position,
+    station[1].quaternionHm, station[1].position, q, t);
+
+  //q and -q are the same rotation. align with the running sum before adding
+  double dot = 0;
+  for (int i = 0; i < 4; i++) {
+    dot += q.q[i] * baseStationQuaternionSum[i];
+  }
+  double sign = (dot < 0) ? -1.0 : 1.0;
+
+  for (int i = 0; i < 3; i++) {
+    baseStationPositionSum[i] += t[i];
+  }
+  for (int i = 0; i < 4; i++) {
+    baseStationQuaternionSum[i] += sign * q.q[i];
+  }
+  nBaseStationSamples++;
+
+  //average of the samples
+  for (int i = 0; i < 3; i++) {
+    baseStationPosition[i] = baseStationPositionSum[i] / nBaseStationSamples;
+  }
+  baseStationQuaternion = Quaternion(baseStationQuaternionSum[0], baseStationQuaternionSum[1],
+    baseStationQuaternionSum[2], baseStationQuaternionSum[3]).normalize();
+
+}
+
+bool PoseTracker::fuseStationPoses(bool updated[2]) {
+
+  //poses of the stations updated in this frame, in the primary station frame
+  Quaternion q[2];
+  double t[2][3];
+  int n = 0;
+
+  if (updated[0]) {
+    q[n] = station[0].quaternionHm;
+    for (int i = 0; i < 3; i++) {
+      t[n][i] = station[0].position[i];
+    }
+    n++;
+  }
+
+  if (updated[1] && isBaseStationTransformValid()) {
+    composePose(baseStationQuaternion, baseStationPosition,
+      station[1].quaternionHm, station[1].position, q[n], t[n]);
+    n++;
+  }
+
+  if (n == 0) {
+    return false;
+  }
+
+  if (n == 1) {
+
+    quaternionHm = q[0];
+    for (int i = 0; i < 3; i++) {
+      position[i] = t[0][i];
+    }
+
+  } else {
+
+    //q and -q are the same rotation. flip before averaging
+    double dot = 0;
+    for (int i = 0; i < 4; i++) {
+      dot += q[0].q[i] * q[1].q[i];
+    }
+    if (dot < 0) {
+      for (int i = 0; i < 4; i++) {
+        q[1].q[i] = -q[1].q[i];
+      }
+    }
+
+    quaternionHm = Quaternion().nlerp(q[0], q[1], 0.5);
+    for (int i = 0; i < 3; i++) {
+      position[i] = 0.5 * (t[0][i] + t[1][i]);
+    }
+
+  }
+
+  return true;
+
 }
@@ -6,12 +6,48 @@
  * Low-level timing and sampling is performed by the Lighthouse and Imu classes.
  * All the math is done in PoseMath.h
  *
+ * Up to two base stations are tracked at the same time. The primary station
+ * (baseStationMode) defines the reference frame of the reported pose. If a
+ * secondary station is set, its pose estimates are mapped into the primary
+ * frame with the base-to-base transform, which is estimated once from frames
+ * in which both stations produce a pose. The two per-station poses are then
+ * fused into one pose, so tracking continues if either station is occluded.
+ *
+ * While a station has a recent pose, the sweep ticks of each diode are
+ * predicted from it and the rotation measured by the IMU since. The ISR
+ * then only accepts sweep pulses within a window around the prediction,
+ * which rejects most reflections at the source.
+ *
+ * If some diodes are occluded, the orientation is taken from the IMU,
+ * aligned to the base station frame with the last pose, and the position
+ * and a yaw correction are solved from the remaining diodes.
+ *
+ * If all diodes are visible and the station has a recent pose, the pose is
+ * refined from the prediction with a few Gauss-Newton steps on the
+ * reprojection error. The homography is only solved to (re)start tracking.
+ *
+ * Optionally, an error-state EKF (see PoseEkf.h) propagates the pose with
+ * every IMU sample and is corrected with the diode projections of the
+ * primary station, which gives a pose at IMU rate.
+ *
+ * A cheaper alternative is the complementary position filter. It removes
+ * gravity from the acc with the IMU orientation aligned to the primary
+ * station, integrates velocity and position with every IMU sample, and
+ * pulls them toward each new lighthouse position.
+ *
+ * Optionally, the orientation of each full pose of the primary station is
+ * blended into the comp filter as a yaw (or full) reference, which removes
+ * the yaw drift of the IMU. The station frame is leveled with its pitch and
+ * roll; the heading offset to the IMU world frame is fixed with the first
+ * reference, so the reported orientation does not jump.
+ *
  */
 
 #pragma once
 #include "Lighthouse.h"
 #include "OrientationTracker.h"
 #include "PoseMath.h"
+#include "PoseEkf.h"
 #include "simulatedLighthouseData.h"
 
 class PoseTracker : public OrientationTracker {
@@ -22,12 +58,15 @@ class PoseTracker : public OrientationTracker {
      * constructor that initializes alpha filter params
      * @param [in] alphaImuTiltCorrectionIn - alpha value [0,1] for complementary filter
      *   1: ignore tilt correction from acc. 0: use full tilt correction from acc
-     * @param [in] int baseStationMode - 0:A, 1:B, 2:C. Only responde to measurements
-     *   from specified base station
+     * @param [in] int baseStationMode - 0:A, 1:B, 2:C. Mode of the primary base station.
+     *   The pose is reported in the frame of this station.
      * @param [in] simulateLighthouseIn - if true, get lighthouse timings from external file
      *   and ignore lighthouse sensor, and IMU readings.
+     * @param [in] secondaryBaseStationMode - 0:A, 1:B, 2:C. Mode of the second base
+     *   station, or -1 to track the primary station only.
      */
-    PoseTracker(double alphaImuFilterIn, int baseStationMode, bool simulateLighthouseIn=false) ;
+    PoseTracker(double alphaImuFilterIn, int baseStationMode, bool simulateLighthouseIn=false,
+      int secondaryBaseStationMode=-1) ;
 
     /**
      * samples photodiodes and processes timing to estimate pose.
@@ -35,92 +74,465 @@ class PoseTracker : public OrientationTracker {
      * updates the orientation, q
      * @returns
      *   - -2: no lighthouse timing available.
-     *   - -1: lighthouse timing available, but invalid data because at
-     *         least 1 diode has 0 detections
+     *   - -1: lighthouse timing available, but invalid data because fewer
+     *         than minPriorSolveAxes diode axes have a plausible detection
+     *         (see getDiodeConfidence()), or some diodes have none and there
+     *         is no previous pose to align the IMU orientation with
      *   -  0: timing available and all diodes have detections,
-     *         but homography estimation fails
+     *         but homography estimation fails, or only the secondary station
+     *         has a pose and the base-to-base transform is not known yet
      *   -  1: timing available, diodes have detections, and pose updated
      */
     int processLighthouse();
 
+    /**
+     * samples and processes imu data, see OrientationTracker::processImu().
+     * also propagates the EKF, if enabled.
+     * @returns true if sampling processing was successful,
+     * false, if no data was available.
+     */
+    bool processImu();
+
+    /**
+     * enables or disables the EKF. it is reinitialized from the next
+     * lighthouse pose when enabled.
+     */
+    void setEkfEnabled(bool enabled);
+
+    /**
+     * true if the EKF is enabled and initialized
+     */
+    bool isEkfValid() const { return ekfEnabled && ekf.isValid(); };
+
+    /**
+     * enables or disables the complementary position filter. it is
+     * reinitialized from the next lighthouse pose when enabled.
+     */
+    void setPositionFilterEnabled(bool enabled);
+
+    /**
+     * extrapolates the pose at imu rate, from the EKF or from the position
+     * filter, with the current angular velocity and velocity. the angular
+     * velocity of the EKF pose is corrected by its gyro bias. compensates
+     * the latency until the pose is displayed.
+     * @param [in] dtAhead - time to predict ahead in s
+     * @param [out] qOut - predicted orientation in the primary station frame
+     * @param [out] posOut - predicted position in the primary station frame, in mm
+     * @returns false if there is no pose at imu rate
+     */
+    bool predictPose(double dtAhead, Quaternion& qOut, double posOut[3]);
+
+    /**
+     * enables or disables the orientation reference from the primary station
+     * @param [in] enabled - if true, blend the lighthouse orientation into quaternionComp
+     * @param [in] yawOnly - if true, only correct the yaw
+     */
+    void setOrientationReference(bool enabled, bool yawOnly=true);
+
+    /**
+     * true if the complementary position filter is enabled and initialized
+     */
+    bool isPositionFilterValid() const { return positionFilterEnabled && positionFilterValid; };
+
+    /**
+     * x,y,z position of board from base station in mm, from the complementary
+     * position filter. in the primary station frame.
+     */
+    const double * getPositionComp() const { return positionComp; };
+
+    /**
+     * @returns CPU cycles spent in the complementary position filter per imu sample
+     */
+    const CycleStats& getPositionFilterCycles() const { return positionFilterCycles; };
+
+    /**
+     * @returns CPU cycles spent in the EKF propagation per imu sample
+     */
+    const CycleStats& getEkfCycles() const { return ekfCycles; };
+
+    /**
+     * starts a new measurement window of the cycle statistics
+     */
+    void resetCycleStats();
+
+    /**
+     * x,y,z position of board from base station in mm, estimated by the EKF.
+     * in the primary station frame.
+     */
+    const double * getPositionEkf() const { return ekf.getPosition(); };
+
+    /**
+     * quaternion of board from base station, estimated by the EKF.
+     * in the primary station frame.
+     */
+    const Quaternion& getQuaternionEkf() const { return ekf.getQuaternion(); };
+
     /**
      * x,y,z position of board from base station. units is mm
+     * fused from both stations, in the primary station frame.
      */
     const double * getPosition() const { return position; };
 
     /**
      * get quaternion of board from base station.
+     * fused from both stations, in the primary station frame.
      */
     const Quaternion& getQuaternionHm() const { return quaternionHm; };
 
+    /**
+     * @returns time of the lighthouse data of position and quaternionHm, in
+     *   FTM0 ticks, i.e. in the same time base as getImuTimestamp()
+     */
+    uint64_t getPoseTimestamp() const { return poseTimestamp; };
+
     /**
      * get pitch of base station in degrees
      */
-    double getBaseStationPitch() { return baseStationPitch; };
+    double getBaseStationPitch() { return station[0].pitch; };
 
     /**
      * get roll of base station in degrees
      */
-    double getBaseStationRoll() { return baseStationRoll; };
+    double getBaseStationRoll() { return station[0].roll; };
 
     /**
      * get mode of base station (0:A, 1:B, 2:C)
      */
-    int getBaseStationMode() { return baseStationMode; };
+    int getBaseStationMode() { return station[0].mode; };
+
+    /**
+     * get mode of secondary base station (0:A, 1:B, 2:C, -1: disabled)
+     */
+    int getSecondaryBaseStationMode() { return station[1].mode; };
 
     /**
      *  get 2D normalized coordinates of diodes, in base station 'sensor' plane
      *  order: sensor0.x, sensor0.y, ... sensor3.x, sensor3.y
+     *  NAN for the axes of occluded diodes
      */
-    const double * getPosition2D() const { return position2D; };
+    const double * getPosition2D() const { return station[0].position2D; };
 
     /**
      * get clock ticks of sweep pulses for each diode, for each axis.
      * order: sensor0.x, sensor0.y, ... sensor3.x, sensor3.y
      */
-    const unsigned long * getClockTicks() const { return clockTicks; };
+    const unsigned long * getClockTicks() const { return station[0].clockTicks; };
 
     /**
      * get number of sweep pulse detections for each diode, for each axis.
      * order: sensor0.x, sensor0.y, ... sensor3.x, sensor3.y
      */
-    const unsigned long * getNumPulseDetections() const { return numPulseDetections; };
+    const unsigned long * getNumPulseDetections() const { return station[0].numPulseDetections; };
 
     /**
      * get width of sweep pulse detections for each diode, for each axis.
      * order: sensor0.x, sensor0.y, ... sensor3.x, sensor3.y
      */
-    const unsigned long *  getPulseWidth() const { return pulseWidth; };
+    const unsigned long *  getPulseWidth() const { return station[0].pulseWidth; };
+
+    /**
+     * get confidence [0,1] that the selected sweep pulse of each diode, for
+     * each axis, is a direct hit. a frame is used if all are at least
+     * minDiodeConfidence. see computeDiodeConfidence() in PoseMath.h
+     * order: sensor0.x, sensor0.y, ... sensor3.x, sensor3.y
+     */
+    const double * getDiodeConfidence() const { return station[0].confidence; };
+
+    /**
+     * number of valid poses in the previous second
+     */
+    int getValidPoseRate() const { return validPoseRate; };
+
+    /**
+     * number of poses in the previous second that would have been valid
+     * if every frame with more than one detection for a diode was dropped
+     */
+    int getStrictPoseRate() const { return strictPoseRate; };
+
+    /**
+     * measured rotor period of the primary base station in clock ticks,
+     * 0 if not measured yet. nominally CLOCKS_PER_SECOND / 60
+     */
+    double getRotorPeriod() const { return station[0].rotorPeriod; };
+
+    /**
+     * the lighthouse, for diagnostics of the pulse decoder
+     */
+    const Lighthouse& getLighthouse() const { return lighthouse; };
+
+    /**
+     * true once the pose of the secondary base station in the primary
+     * station frame has been estimated
+     */
+    bool isBaseStationTransformValid() const {
+      return nBaseStationSamples >= nBaseStationTransformSamples;
+    };
+
+    /**
+     * position of the secondary base station in the primary station frame, in mm
+     */
+    const double * getBaseStationPosition() const { return baseStationPosition; };
+
+    /**
+     * orientation of the secondary base station in the primary station frame
+     */
+    const Quaternion& getBaseStationQuaternion() const { return baseStationQuaternion; };
 
 
     /**
      * sets desired mode of base station
+     * if the mode is the one of the secondary station, the stations are swapped.
+     * resets the base-to-base transform.
      * @param [in] mode - desired mode (0:A, 1:B, 2:C)
      */
-    void setMode(int mode) { baseStationMode = mode; };
+    void setMode(int mode);
+
+    /**
+     * sets mode of the secondary base station. resets the base-to-base transform.
+     * @param [in] mode - desired mode (0:A, 1:B, 2:C), -1 to disable
+     */
+    void setSecondaryMode(int mode);
 
   protected:
 
+    /**
+     * measurements and pose estimate of the board w.r.t. a single base station
+     */
+    struct Station {
+
+      /** base station mode (0:A, 1:B, 2:C), -1 if not tracked */
+      int mode;
+
+      /**
+       * base station pitch in degrees (rotation about x-axis)
+       * ref frame is y points up, z points toward back of lighthouse (usually)
+       */
+      double pitch;
+
+      /**
+       * base station roll in degrees (rotation about z-axis)
+       * ref frame is y points up, z points toward back of lighthouse (usually)
+       */
+      double roll;
+
+      /**
+       * clock ticks of sweep pulses since last sync pulse, as detected by
+       * each photodiode
+       * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
+       */
+      unsigned long clockTicks[8];
+
+      /**
+       * time of clockTicks: start of the sync pulse of the latest sweep,
+       * in FTM0 ticks (see InputCapture::now())
+       */
+      uint64_t timestamp;
+
+      /**
+       * number of pulse detections
+       * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
+       * would be more than 1 if there are inter-reflections
+       * would be 0 if 1 is covered
+       */
+      unsigned long numPulseDetections[8];
+
+      /**
+       * pulse width in clock ticks. 1 clock ticks is (1/48MHz) s
+       * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
+       * for debugging purposes
+       */
+      unsigned long pulseWidth[8];
+
+      /**
+       * ticks between the selected sweep pulse and the center of the
+       * sweep window, i.e. the predicted pulse or the pulse of the
+       * previous period
+       * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
+       */
+      unsigned long pulseDifference[8];
+
+      /**
+       * confidence [0,1] that the selected sweep pulse is a direct hit
+       * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
+       */
+      double confidence[8];
+
+      /**
+       * true if every diode axis had exactly one detection in the frame
+       */
+      bool singleDetections;
+
+      /**
+       * 2D normalied coordinates of 4 photodiodes. These are the measured
+       * reprojection of the photodiodes on the a plane a unit distance away
+       * from the base station.
+       * order is sensor0x, sensor0y,...sensor3x, sensor3y.
+       * NAN if the axis of the diode is occluded
+       */
+      double position2D[8];
+
+      /**
+       * most recent estimate of translation (order: x,y,z) in mm,
+       * in the frame of this base station
+       */
+      double position[3];
+
+      /**
+       * most recent estimate of quaternion from the homography,
+       * in the frame of this base station
+       */
+      Quaternion quaternionHm;
+
+      /** time of the most recent pose estimate in us */
+      unsigned long poseTime;
+
+      /** true if position and quaternionHm hold a valid estimate */
+      bool hasPose;
+
+      /** orientation of the IMU filter at poseTime */
+      Quaternion quaternionImu;
+
+      /** true if the ISR gates the sweep pulses of this station */
+      bool sweepGated;
+
+      /** factory calibration of the base station from the OOTX frame */
+      BaseStationCalibration calibration;
+
+      /** measured rotor period in clock ticks, 0 if not measured yet */
+      double rotorPeriod;
+
+      Station(int modeIn) :
+        mode(modeIn),
+        pitch(0),
+        roll(0),
+        clockTicks{0,0,0,0,0,0,0,0},
+        timestamp(0),
+        numPulseDetections{0,0,0,0,0,0,0,0},
+        pulseWidth{0,0,0,0,0,0,0,0},
+        pulseDifference{0,0,0,0,0,0,0,0},
+        confidence{0,0,0,0,0,0,0,0},
+        singleDetections(false),
+        position2D{0,0,0,0,0,0,0,0},
+        position{0,0,-500},
+        quaternionHm(),
+        poseTime(0),
+        hasPose(false),
+        quaternionImu(),
+        sweepGated(false),
+        calibration(),
+        rotorPeriod(0)
+      {}
+
+    };
+
+    /**
+     * reads the timings of one station from the lighthouse (or from the
+     * simulation for the primary station), and estimates the pose in
+     * the frame of this station.
+     * @returns same codes as processLighthouse()
+     */
+    int processStation(Station& s);
+
     /**
      * Use the functions in PoseMath.h to get from clockTicks, to a new
      * position and quaternion estimate, in the base station frame, where
      * y is the normal of the top face of the base station, z points to the back
      * You should not do any math here; use the functions in PoseMath.h.
      *
-     * You will need to access the following fields defined in this class:
-     *  - clockTicks
-     *  - position2D
+     * If the last pose is recent, it is refined with refinePose(), starting
+     * from the predicted orientation. The homography is used otherwise, or
+     * if the refinement does not converge.
+     *
+     * You will need to access the following fields:
+     *  - s.clockTicks
+     *  - s.position2D
      *  - positionRef
-     *  - position
-     *  - quaternionHm
+     *  - s.position
+     *  - s.quaternionHm
      *
-     * The position and quaternionHm variables should be updated to the
+     * The s.position and s.quaternionHm variables should be updated to the
      * new estimate.
      *
      * @returns  0:if any errors occur (eg failed matrix inversion),
      *           1: if successful.
      */
-    int updatePose();
+    int updatePose(Station& s);
+
+    /**
+     * estimates the pose from the valid diode axes only, using the IMU
+     * orientation aligned with the last pose as prior. see
+     * solveWithOrientationPrior() in PoseMath.h
+     * @param [in] valid - true for each diode axis with a plausible detection
+     * @param [in] nValid - number of valid diode axes
+     * @returns  0:if any errors occur, 1: if successful.
+     */
+    int updatePoseWithPrior(Station& s, bool valid[8], int nValid);
+
+    /**
+     * orientation of the board in the station frame, predicted from the last
+     * pose and the rotation measured by the IMU since.
+     * @param [out] upOut - up vector of the IMU frame in the station frame
+     */
+    Quaternion predictQuaternion(Station& s, double upOut[3]);
+
+    /**
+     * accumulates the base-to-base transform from the current pose of both
+     * stations, if they were estimated at (nearly) the same time.
+     */
+    void updateBaseStationTransform();
+
+    /**
+     * fuses the station poses that were updated in this frame into
+     * position and quaternionHm, in the primary station frame.
+     * @param [in] updated - true for each station with a new pose
+     * @returns true if the fused pose was updated
+     */
+    bool fuseStationPoses(bool updated[2]);
+
+    /** restarts estimation of the base-to-base transform */
+    void resetBaseStationTransform();
+
+    /**
+     * predicts the sweep ticks of the station from its last pose, rotated by
+     * the change of the IMU orientation since, and sets the sweep windows of
+     * the ISR around them. stops gating if the last pose is too old.
+     */
+    void updateSweepWindows(Station& s);
+
+    /** stops gating the sweep pulses of both stations */
+    void clearSweepWindows();
+
+    /**
+     * corrects the EKF with the diode projections of the primary station,
+     * also of frames that are not solved, or initializes it from its pose
+     * @param [in] solved - true if the pose of the frame was updated
+     */
+    void updateEkf(bool solved);
+
+    /**
+     * blends the orientation of the pose of the station into quaternionComp,
+     * and keeps the alignment of the stations with the IMU frame
+     */
+    void applyOrientationReference(Station& s);
+
+    /**
+     * integrates the acc, without gravity, into velocityComp and positionComp
+     */
+    void propagatePositionFilter();
+
+    /**
+     * pulls positionComp and velocityComp toward the lighthouse position,
+     * or initializes them from it
+     */
+    void correctPositionFilter();
+
+    /**
+     * counts a processed frame for the valid pose rates
+     * @param [in] valid - true if the pose was updated
+     * @param [in] singleDetections - true if the pose was estimated from
+     *   frames with exactly one detection per diode axis
+     */
+    void updatePoseRates(bool valid, bool singleDetections);
 
     /** lighthouse object for sampling from lighthouse */
     Lighthouse lighthouse;
@@ -148,60 +560,188 @@ class PoseTracker : public OrientationTracker {
      */
     Quaternion quaternionHm;
 
+    /**
+     * time of the lighthouse data of position and quaternionHm, in FTM0 ticks
+     */
+    uint64_t poseTimestamp;
+
+    /**
+     * measurements and pose of each base station.
+     * station[0] is the primary station, station[1] the secondary.
+     */
+    Station station[2];
 
     /**
-     * base station pitch in degrees (rotation about x-axis)
-     * ref frame is y points up, z points toward back of lighthouse (usually)
+     * pose of the secondary base station in the primary station frame.
+     * maps points from the secondary station frame into the primary one.
      */
-    double baseStationPitch;
+    double baseStationPosition[3];
+    Quaternion baseStationQuaternion;
 
     /**
-     * base station roll in degrees (rotation about z-axis)
-     * ref frame is y points up, z points toward back of lighthouse (usually)
+     * running sums of the base-to-base transform samples
      */
-    double baseStationRoll;
+    double baseStationPositionSum[3];
+    double baseStationQuaternionSum[4];
 
     /**
-     * base station mode (0:A, 1:B, 2:C)
+     * number of base-to-base transform samples accumulated so far
      */
-    int baseStationMode;
+    int nBaseStationSamples;
 
     /**
-     * 2D normalied coordinates of 4 photodiodes. These are the measured
-     * reprojection of the photodiodes on the a plane a unit distance away
-     * from the base station.
-     * order is sensor0x, sensor0y,...sensor3x, sensor3y
+     * number of samples averaged into the base-to-base transform
      */
-    double position2D[8];
+    static const int nBaseStationTransformSamples = 60;
 
     /**
-     * 2D actual coordinates of the photodioes, based on the board layout.
-     * units is mm. order is: sensor0x, sensor0y,...sensor3x, sensor3y
+     * maximum time between the poses of the two stations, in us, to
+     * use them for the base-to-base transform. stations sweep alternately,
+     * so consecutive poses are about 8.3 ms apart.
      */
-    double positionRef[8] = {-42.0, 25.0, 42.0, 25.0, 42.0, -25.0, -42.0, -25.0};
+    static const unsigned long maxStationTimeOffset = 20000;
 
     /**
-     * clock ticks of sweep pulses since last sync pulse, as detected by
-     * each photodiode
-     * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
-     * not needed for visualization, can be used for debugging
+     * minimum confidence of every diode axis to use a frame
      */
-    unsigned long clockTicks[8];
+    double minDiodeConfidence = 0.5;
 
     /**
-     * number of pulse detections
-     * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
-     * would be more than 1 if there are inter-reflections
-     * would be 0 if 1 is covered
+     * number of Gauss-Newton steps of the pose refinement
      */
-    unsigned long numPulseDetections[8];
+    int nRefineIterations = 2;
 
     /**
-     * pulse width in clock ticks. 1 clock ticks is (1/48MHz) s
-     * order is : sensor0H, sensor0V, ... sensor3H, sensor3V
-     * for debugging purposes
+     * the refined pose is rejected if the rms reprojection error is larger,
+     * in units of the plane at unit distance (about 0.1 degrees)
      */
-    unsigned long pulseWidth[8];
+    double maxReprojectionError = 0.002;
 
+    /**
+     * minimum number of valid diode axes to estimate the pose with the
+     * IMU orientation prior
+     */
+    int minPriorSolveAxes = 4;
+
+    /**
+     * minimum number of valid diode axes to also correct the yaw of the
+     * IMU orientation prior
+     */
+    int minPriorYawAxes = 5;
+
+    /**
+     * sweep pulses narrower than this are considered less reliable.
+     * in clock ticks (1 us)
+     */
+    unsigned long minSweepPulseWidth = CLOCKS_PER_SECOND / 1000000;
+
+    /**
+     * if there are several detections, selected pulses further than this
+     * from the center of the sweep window are considered less reliable.
+     * in clock ticks (about 0.9 degrees)
+     */
+    unsigned long maxSweepPulseDifference = 2000;
+
+    /**
+     * half width of the predicted sweep windows in clock ticks (about 1.8 degrees)
+     */
+    unsigned long sweepWindowHalfWidth = 4000;
+
+    /**
+     * the sweep pulses are only gated while the last pose is younger than this, in us
+     */
+    unsigned long maxSweepPredictionAge = 100000;
+
+    /**
+     * minimum time between updates of the sweep windows, in us
+     */
+    unsigned long sweepWindowPeriod = 2000;
+
+    /** time of the last update of the sweep windows in us */
+    unsigned long sweepWindowTime = 0;
+
+    /**
+     * valid poses, and poses from single-detection frames only,
+     * counted in the current and reported for the previous second
+     */
+    int nValidPoses;
+    int nStrictPoses;
+    int validPoseRate;
+    int strictPoseRate;
+
+    /** start of the current pose rate window in us */
+    unsigned long poseRateWindowStart;
+
+    /** EKF fusing the IMU and the primary station */
+    PoseEkf ekf;
+
+    /** true if the EKF is run */
+    bool ekfEnabled;
+
+    /** number of consecutive EKF corrections that were rejected */
+    int nEkfRejections;
+
+    /** the EKF is reinitialized after this many consecutive rejected corrections */
+    int maxEkfRejections = 30;
+
+    /** true if the complementary position filter is run */
+    bool positionFilterEnabled;
+
+    /** true once the position filter was initialized from a lighthouse position */
+    bool positionFilterValid;
+
+    /** position (mm) and velocity (mm/s) of the position filter, in the primary station frame */
+    double positionComp[3];
+    double velocityComp[3];
+
+    /** time of the lighthouse position of the last correction, in FTM0 ticks */
+    uint64_t positionFilterTime;
+
+    /**
+     * rate at which the position error is corrected, in 1/s. a correction
+     * dt after the previous one removes 1 - exp(-positionFilterGain * dt)
+     * of the error, so the filter does not depend on the lighthouse frame rate.
+     * 27 corrects 20% per frame at 120 Hz
+     */
+    double positionFilterGain = 27;
+
+    /**
+     * velocity correction per second and mm of position error, in 1/s^2.
+     * scaled by the time since the previous correction
+     */
+    double velocityFilterGain = 240;
+
+    /**
+     * the time since the previous correction is limited to this, in s,
+     * so that a correction after a gap does not overshoot
+     */
+    double maxPositionFilterStep = 0.05;
+
+    /**
+     * the position filter is reinitialized if the error is larger than this, in mm
+     */
+    double maxPositionFilterError = 100;
+
+    /** CPU cycles spent in the position filter and the EKF propagation */
+    CycleStats positionFilterCycles;
+    CycleStats ekfCycles;
+
+    /** true if the primary station is used as orientation reference */
+    bool orientationReferenceEnabled;
+
+    /** true if only the yaw of the reference is used */
+    bool orientationReferenceYawOnly;
+
+    /** true once referenceOffset was set from the first reference */
+    bool hasReferenceOffset;
+
+    /** rotation about the y-axis from the leveled station frame to the IMU world frame */
+    Quaternion referenceOffset;
+
+    /**
+     * 2D actual coordinates of the photodioes, based on the board layout.
+     * units is mm. order is: sensor0x, sensor0y,...sensor3x, sensor3y
+     */
+    double positionRef[8] = {-42.0, 25.0, 42.0, 25.0, 42.0, -25.0, -42.0, -25.0};
 
 };
@@ -63,12 +63,40 @@ struct PulseData {
     volatile uint32_t numPulseDetectionsTemp[8];
 
     /**
-     * pulse difference between current and previous period. used
+     * pulse difference to the center of the sweep window. used
      * to choose which pulse to select in the case of multiple
      * sweep pulse detections due to interreflections
      */
     volatile uint32_t minPulseDifferences[8];
 
+    /**
+     * difference of the selected sweep pulse of the previous period to the
+     * pulse of the period before. large if the selected pulse is a reflection
+     */
+    volatile uint32_t sweepPulseDifference[8];
+
+    /**
+     * window of accepted sweep ticks of the current period. a sweep pulse
+     * is accepted if (sweepTicks - sweepWindowStart) <= sweepWindowWidth,
+     * in unsigned arithmetic. sweep pulses outside the window are ignored.
+     * if sweepGateEnabled is false, the window spans all ticks and is
+     * centered on the pulse of the previous period.
+     */
+    volatile uint32_t sweepWindowStart[8];
+    volatile uint32_t sweepWindowWidth[8];
+
+    /**
+     * start of the sync pulse of the sweep period in the permanent buffers,
+     * and of the current sweep period
+     */
+    volatile uint32_t sweepSyncTicks;
+    volatile uint32_t sweepSyncTicksTemp;
+
+    /**
+     * true if the sweep windows are predicted by the pose tracker
+     */
+    volatile bool sweepGateEnabled;
+
     /**
      * true if there are new pulse timings from this station.
      */
@@ -92,6 +120,25 @@ struct PulseData {
     /** decoder for base station info */
     LighthouseOOTX ootx;
 
+    /** predicted start of the next sync pulse of this station, while locked */
+    volatile uint32_t nextSyncPulseTicks;
+
+    /** true if the sync pulses of this station were seen since the lock was acquired */
+    volatile bool syncActive;
+
+    /** number of consecutive predicted sync pulses that were not seen */
+    volatile uint32_t missedSyncs;
+
+    /** start of the last sync pulse of this station, while locked */
+    volatile uint32_t lastSyncPulseTicks;
+
+    /**
+     * measured ticks between two sync pulses of this station, times 16
+     * (fixed point, low-pass filtered). 0 until measured.
+     * the rotor period is twice the sync period.
+     */
+    volatile uint32_t syncPeriodTicks16;
+
     Station() :
       sweepPulseTicks{0,0,0,0,0,0,0,0},
       sweepPulseTicksTemp{0,0,0,0,0,0,0,0},
@@ -100,13 +147,28 @@ struct PulseData {
       numPulseDetections{0,0,0,0,0,0,0,0},
       numPulseDetectionsTemp{0,0,0,0,0,0,0,0},
       minPulseDifferences{0,0,0,0,0,0,0,0},
+      sweepPulseDifference{0,0,0,0,0,0,0,0},
+      sweepWindowStart{
+        0x80000001,0x80000001,0x80000001,0x80000001,
+        0x80000001,0x80000001,0x80000001,0x80000001},
+      sweepWindowWidth{
+        0xFFFFFFFF,0xFFFFFFFF,0xFFFFFFFF,0xFFFFFFFF,
+        0xFFFFFFFF,0xFFFFFFFF,0xFFFFFFFF,0xFFFFFFFF},
+      sweepSyncTicks(0),
+      sweepSyncTicksTemp(0),
+      sweepGateEnabled(false),
       dataAvailable(false),
       axis(0),
       skip(true),
       pitch(0.0),
       roll(0.0),
       mode(-1),
-      ootx()
+      ootx(),
+      nextSyncPulseTicks(0),
+      syncActive(false),
+      missedSyncs(0),
+      lastSyncPulseTicks(0),
+      syncPeriodTicks16(0)
     {
 
    }
@@ -131,6 +193,21 @@ struct PulseData {
    */
   volatile uint32_t fallingEdgeTicks[4];
 
+  /**
+   * true while the sync pulses are assigned to the stations by predicting
+   * them from the known cadence, see LighthouseInputCapture::getSyncStationIndex()
+   */
+  volatile bool syncLocked;
+
+  /** number of times the lock was (re)acquired */
+  volatile uint32_t syncResyncs;
+
+  /** total number of predicted sync pulses that were not seen */
+  volatile uint32_t syncMissedTotal;
+
+  /** number of sync pulses that did not match a prediction and were ignored */
+  volatile uint32_t syncRejected;
+
   /**
    * Array of data from each station
    */
@@ -142,6 +219,10 @@ struct PulseData {
     lastValidSyncPulseTicks(0),
     lastAnySyncPulseTicks(0),
     fallingEdgeTicks{0,0,0,0},
+    syncLocked(false),
+    syncResyncs(0),
+    syncMissedTotal(0),
+    syncRejected(0),
     station{Station(), Station()}
   {}
 };
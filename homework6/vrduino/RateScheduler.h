@@ -0,0 +1,68 @@
+/**
+ * @file
+ * schedules a periodic output, e.g. a message stream, at a rate that is
+ * independent of the rate of the loop that polls it.
+ * usage:
+ *   RateScheduler scheduler(500);
+ *   ...
+ *   if (scheduler.due(micros())) { send(); }
+ */
+
+#pragma once
+#include <Arduino.h>
+
+class RateScheduler {
+
+public:
+
+  /**
+   * @param rate - rate in Hz. 0: due every time it is polled
+   */
+  RateScheduler(double rate = 0) : period(0), next(0) { setRate(rate); }
+
+  /**
+   * @param rate - rate in Hz. 0: due every time it is polled. the period
+   *  is at most INT32_MAX us (about 36 min), the longest that due() can
+   *  compare across the wrap of micros(), lower rates are clamped to it
+   */
+  void setRate(double rate) {
+    double periodUs = (rate > 0) ? 1000000.0 / rate : 0;
+    period = (periodUs < INT32_MAX) ? (uint32_t)periodUs : INT32_MAX;
+  }
+
+  /** @returns rate in Hz, 0 if due every time */
+  double getRate() const { return (period > 0) ? 1000000.0 / period : 0; }
+
+  /**
+   * @param now - current time in us, e.g. micros()
+   * @returns true if the output is due. the next one is scheduled one
+   *  period later, or one period after now if the output fell behind by
+   *  more than a period, so that missed outputs are not sent in a burst
+   */
+  bool due(uint32_t now) {
+
+    if (period == 0) {
+      return true;
+    }
+
+    if ((int32_t)(now - next) < 0) {
+      return false;
+    }
+
+    next += period;
+    if ((int32_t)(now - next) >= 0) {
+      next = now + period;
+    }
+    return true;
+
+  }
+
+private:
+
+  /** period in us, 0 if due every time */
+  uint32_t period;
+
+  /** time in us of the next output */
+  uint32_t next;
+
+};
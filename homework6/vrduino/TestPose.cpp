@@ -6,9 +6,144 @@ bool testPose1() {
 
 }
 
-void testPoseMain() {
+/* assigns the sync pulses of two stations, while the syncs of station 0
+   are dropped for a while. the stations must keep their index */
+bool testSyncLock() {
+
+  //pin 0 has no input capture, the ISR never calls this one
+  PulseData pulseData;
+  LighthouseInputCapture capture(0, RISING, 0, &pulseData);
+
+  //the ticks wrap around during the test
+  uint32_t t = 0xFFF00000;
+  int nWrong = 0;
+  int nAssigned[2] = {0, 0};
+
+  for (int period = 0; period < 80; period++) {
+
+    //station 0 is occluded in periods 20 to 59
+    bool occluded = period >= 20 && period < 60;
+
+    for (int i = 0; i < 2; i++) {
+
+      if (i == 0 && occluded) {
+        continue;
+      }
+
+      uint32_t syncTicks = t + i * SYNC_STATION_OFFSET_TICKS;
+      int pid = capture.getSyncStationIndex(syncTicks);
+      pulseData.lastAnySyncPulseTicks = syncTicks;
+
+      //the first syncs are needed to acquire the lock
+      if (period >= 2) {
+        if (pid != i) {
+          nWrong++;
+        } else {
+          nAssigned[i]++;
+        }
+      }
+
+    }
+
+    t += SYNC_PERIOD_TICKS;
+
+  }
+
+  Serial.printf("sync lock: %d syncs of station 0, %d of station 1, %d wrong, %lu resyncs\n",
+    nAssigned[0], nAssigned[1], nWrong, (unsigned long)pulseData.syncResyncs);
+
+  //station 0 is locked again in the first period it is seen
+  return nWrong == 0 && nAssigned[0] == 38 && nAssigned[1] == 78 &&
+    pulseData.syncLocked && pulseData.syncResyncs == 1;
+
+}
+
+/* error of the quantized telemetry on the simulated data. the tracker
+   must be constructed with simulateLighthouse */
+bool testTelemetryQuantization(PoseTracker& tracker) {
+
+  //quaternions of the comp filter on the simulated imu data
+  OrientationTracker orientationTracker(0.99, true);
+  int nQuaternions = nImuSamples / 6;
+  double maxAngle = 0;
+  double sumAngle2 = 0;
+
+  for (int i = 0; i < nQuaternions; i++) {
+
+    orientationTracker.processImu();
+    const Quaternion& q = orientationTracker.getQuaternionComp();
+    Quaternion d = unpackQuaternion(packQuaternion(q));
+
+    double dot = fabs(q.q[0]*d.q[0] + q.q[1]*d.q[1] + q.q[2]*d.q[2] + q.q[3]*d.q[3]);
+    double angle = 2 * acos(min(dot, 1.0)) * RAD_TO_DEG;
+    maxAngle = max(maxAngle, angle);
+    sumAngle2 += angle * angle;
+
+  }
+
+  Serial.printf("quaternion error in deg: max %.4f rms %.4f (%d samples)\n",
+    maxAngle, sqrt(sumAngle2 / nQuaternions), nQuaternions);
+
+  //positions of the simulated lighthouse data, through the codec
+  PositionCodec encoder;
+  PositionCodec decoder;
+  int nPositions = 0;
+  int nBytes = 0;
+  double maxError = 0;
+  double sumError2 = 0;
+  bool decoded = true;
+
+  for (int i = 0; i < nLighthouseSamples / 8; i++) {
+
+    if (tracker.processLighthouse() != 1) {
+      continue;
+    }
+
+    const double* position = tracker.getPosition();
+    uint8_t bytes[13];
+    double p[3];
+    int n = encoder.encode(position, bytes);
+    nBytes += n;
+
+    //the decoder keeps tracking the keyframes after a failed position,
+    //which has no error
+    bool positionDecoded = decoder.decode(bytes, n, p) == n;
+    decoded = decoded && positionDecoded;
+    if (!positionDecoded) {
+      continue;
+    }
+
+    double error2 = 0;
+    for (int j = 0; j < 3; j++) {
+      maxError = max(maxError, fabs(p[j] - position[j]));
+      error2 += sq(p[j] - position[j]);
+    }
+    sumError2 += error2;
+    nPositions++;
+
+  }
+
+  if (nPositions == 0) {
+    Serial.printf("no valid pose in the simulated lighthouse data\n");
+    return false;
+  }
+
+  Serial.printf("position error in mm: max %.4f rms %.4f (%d poses)\n",
+    maxError, sqrt(sumError2 / nPositions), nPositions);
+  Serial.printf("position bytes: %.2f per pose, 12 unquantized\n",
+    (double)nBytes / nPositions);
+
+  //the components are rounded to 1.4/1023, the deltas to 0.1 mm
+  return decoded && maxAngle < 0.25 && maxError < 0.051;
+
+}
+
+void testPoseMain(PoseTracker& tracker) {
 
   Serial.printf("testing\n");
   testPose1();
+  Serial.printf("sync lock: %s\n", testSyncLock() ? "passed" : "failed");
+  Serial.printf("telemetry quantization: %s\n",
+    testTelemetryQuantization(tracker) ? "passed" : "failed");
 
 }
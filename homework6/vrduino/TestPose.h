@@ -7,8 +7,14 @@
 #pragma once
 
 #include "PoseMath.h"
+#include "PoseTracker.h"
+#include "Telemetry.h"
 #include "TestUtil.h"
 
 bool testPose1();
 
-void testPoseMain();
+bool testSyncLock();
+
+bool testTelemetryQuantization(PoseTracker& tracker);
+
+void testPoseMain(PoseTracker& tracker);
@@ -21,6 +21,9 @@
 #include "TestPose.h"
 #include "PoseTracker.h"
 #include "InputCapture.h"
+#include "Telemetry.h"
+#include "CycleCounter.h"
+#include "RateScheduler.h"
 
 //complementary filter value [0,1].
 //1: ignore acc tilt, 0: use all acc tilt
@@ -39,13 +42,169 @@ const int B = 1;
 const int C = 2;
 int baseStationMode = B;
 
+//mode of a second base station tracked at the same time, -1 to disable.
+//the pose is reported in the frame of the station in baseStationMode.
+int secondaryBaseStationMode = C;
+
+//if true, fuse imu and lighthouse with an EKF and report the pose at imu rate.
+//the simulated lighthouse timings do not match the imu, so it is only
+//used with the physical lighthouse
+bool useEkf = true;
+
+//if true, report the position at imu rate with the complementary position
+//filter. cheaper alternative to the EKF, it is not used if the EKF is
+bool usePositionFilter = false;
+
+//if true, the orientation from the lighthouse corrects the yaw drift of
+//the imu comp filter. if useFullReference, it corrects the tilt too. not
+//used with simulateLighthouse, the recorded poses are not of the board
+bool useOrientationReference = true;
+bool useFullReference = false;
+
+//time in s the poses reported at imu rate are extrapolated ahead, to
+//compensate the latency of the serial transmission and of the rendering,
+//e.g. 0.02. 0: report the measured pose
+double predictionHorizon = 0;
+
+//orientation estimators updated with each imu sample, see
+//OrientationTracker.h. the pose only uses the quaternion of the comp filter
+int orientationEstimators = EST_QUATERNION_COMP;
+
+//the comp filter integrates the gyro with every imu sample, and corrects
+//the tilt with the acc every tiltCorrectionInterval samples, with the same
+//time constant. 1: every sample. see ComplementaryFilter
+int tiltCorrectionInterval = 4;
+
+//method to integrate the gyro, see GyroIntegration. GYRO_CONING is of
+//second order, and more accurate for fast rotations at little extra cost
+GyroIntegration gyroIntegration = GYRO_CONING;
+
+//if true, send binary frames (see Telemetry.h), which server.js converts
+//to text for the browser. if false, print text. must match server.js
+bool binaryTelemetry = true;
+
+//if true, binary frames pack quaternions into 32 bits and send positions
+//as deltas from a keyframe. the precision is about that of 3 decimals
+bool quantizeTelemetry = true;
+
+//rates in Hz of the output streams, 0: send every update.
+//the sensors are processed as fast as their data arrives
+//imu pose: TI, QC, and PS/QH of the EKF or the position filter
+double imuPoseRate = 500;
+//lighthouse pose: BS, NP, TL, PS, QH, PD
+double lighthouseRate = 0;
+//diagnostics: VP, LS, CY, LR, GYR_TEMP
+double diagnosticsRate = 1;
+
+//message types sent on start, bitwise or of telemetryMask(). the host can
+//change them and the rates with the commands in Telemetry.h
+uint32_t subscriptions = TM_ALL;
+
 //if true, measure the imu bias on start
 bool measureImuBias = true;
 
 //if measureImuBias is false, set the imu bias to the following
 double imuBias[3] = {0, 0, 0};
 
-PoseTracker tracker(alphaImuFilter, baseStationMode, simulateLighthouse);
+//imu temperature in deg C at which imuBias was measured, NAN: unknown,
+//and the change of the gyro bias per deg C. the learned values are sent
+//in GYR_TEMP with the diagnostics
+double imuBiasTemperature = NAN;
+double imuBiasSlope[3] = {0, 0, 0};
+
+//if true, learn the gyro bias over the imu temperature while the imu is
+//stationary, so that the bias does not have to be measured again
+bool learnGyrBias = true;
+
+PoseTracker tracker(alphaImuFilter, baseStationMode, simulateLighthouse,
+  secondaryBaseStationMode);
+
+Telemetry telemetry(binaryTelemetry);
+
+RateScheduler imuPoseScheduler(imuPoseRate);
+RateScheduler lighthouseScheduler(lighthouseRate);
+RateScheduler diagnosticsScheduler(diagnosticsRate);
+
+//streams indexed as in CMD_SET_RATE and TM_CONFIG
+RateScheduler* streams[] = {&imuPoseScheduler, &lighthouseScheduler, &diagnosticsScheduler};
+const int nStreams = 3;
+
+//iterations of loop(), imu samples and lighthouse frames processed since
+//start, their values at the last diagnostics, and its time in us
+unsigned long nLoops = 0;
+unsigned long nImuUpdates = 0;
+unsigned long nLighthouseUpdates = 0;
+unsigned long prevLoops = 0;
+unsigned long prevImuUpdates = 0;
+unsigned long prevLighthouseUpdates = 0;
+unsigned long prevDiagnosticsTime = 0;
+
+//cycles spent sending the messages of an iteration of loop()
+CycleStats outputCycles;
+
+//converts FTM0 ticks to the us in the timestamps of the messages.
+//64 bit, like the ticks, so the timestamps do not wrap around
+uint64_t ticksToMicros(uint64_t ticks) {
+  return ticks / (F_BUS / 1000000);
+}
+
+//executes a command from the host
+void handleCommand(const Command& command) {
+
+  if (command.type == CMD_KEY) {
+
+    int byteRead = command.payload[0];
+    int desiredMode  = byteRead - 48;
+
+    if (desiredMode >= 0 && desiredMode <= 2) {
+
+      tracker.setMode(desiredMode);
+
+    } else if (byteRead == 'r') {
+
+      //reset orientation tracking
+      tracker.resetOrientation();
+
+    } else if (byteRead == 'b') {
+
+      //remeasure bias
+      tracker.measureImuBiasVariance();
+
+    }
+
+  } else if (command.type == CMD_SUBSCRIBE) {
+
+    telemetry.setSubscriptions(command.getUint(0));
+
+  } else if (command.type == CMD_SET_RATE) {
+
+    if (command.length >= 5 && command.payload[0] < nStreams) {
+      streams[command.payload[0]]->setRate(command.getFloat(1));
+    }
+
+  } else if (command.type == CMD_GET_CONFIG) {
+
+    telemetry.begin(TM_CONFIG, ticksToMicros(InputCapture::now()));
+    telemetry.addUint(telemetry.getSubscriptions());
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++) {
+      telemetry.addFloat(i < nStreams ? streams[i]->getRate() : 0, 2);
+    }
+    telemetry.end();
+
+  } else if (command.type == CMD_GET_COUNTERS) {
+
+    telemetry.begin(TM_COUNTERS, ticksToMicros(InputCapture::now()));
+    telemetry.addUint(nLoops);
+    telemetry.addUint(nImuUpdates);
+    telemetry.addUint(nLighthouseUpdates);
+    telemetry.addUint(telemetry.getFramesSent());
+    telemetry.addUint(telemetry.getCommandsReceived());
+    telemetry.addUint(telemetry.getCommandErrors());
+    telemetry.end();
+
+  }
+
+}
 
 void setup() {
 
@@ -53,11 +212,13 @@ void setup() {
   if (test) {
 
     delay(1000);
-    testPoseMain();
+    testPoseMain(tracker);
     return;
 
   }
 
+  telemetry.setQuantized(quantizeTelemetry);
+  telemetry.setSubscriptions(subscriptions);
   tracker.initImu();
 
   if (measureImuBias) {
@@ -66,10 +227,21 @@ void setup() {
 
   } else {
 
-    tracker.setImuBias(imuBias);
+    tracker.setImuBias(imuBias, imuBiasTemperature);
 
   }
 
+  tracker.setImuBiasSlope(imuBiasSlope);
+  tracker.setGyrBiasLearning(learnGyrBias);
+
+  tracker.setEkfEnabled(useEkf && !simulateLighthouse);
+  tracker.setPositionFilterEnabled(usePositionFilter && !useEkf && !simulateLighthouse);
+  tracker.setOrientationReference(useOrientationReference && !simulateLighthouse,
+    !useFullReference);
+  tracker.setEstimators(orientationEstimators);
+  tracker.getFilter().setCorrectionInterval(tiltCorrectionInterval);
+  tracker.getFilter().setIntegration(gyroIntegration);
+
 }
 
 void loop() {
@@ -80,27 +252,9 @@ void loop() {
 
   }
 
-  if (Serial.available()) {
-
-    int byteRead = Serial.read();
-    int desiredMode  = byteRead - 48;
-
-    if (desiredMode >= 0 && desiredMode <= 2) {
-
-      tracker.setMode(desiredMode);
-
-    } else if (byteRead == 'r') {
-
-      //reset orientation tracking
-      tracker.resetOrientation();
-
-    } else if (byteRead == 'b') {
-
-      //remeasure bias
-      tracker.measureImuBiasVariance();
-
-    }
-
+  Command command;
+  while (telemetry.readCommand(command)) {
+    handleCommand(command);
   }
 
 
@@ -111,6 +265,17 @@ void loop() {
   imuTrack = tracker.processImu();
   hmTrack = tracker.processLighthouse();
 
+  nLoops++;
+  if (imuTrack) {
+    nImuUpdates++;
+  }
+  if (hmTrack > -2) {
+    nLighthouseUpdates++;
+  }
+
+  unsigned long now = micros();
+  bool lighthouseDue = hmTrack > -2 && lighthouseScheduler.due(now);
+
   //get values from tracker
   double pitch = tracker.getBaseStationPitch();
   double roll = tracker.getBaseStationRoll();
@@ -118,58 +283,171 @@ void loop() {
   const unsigned long * numPulseDetections = tracker.getNumPulseDetections();
   const double * position = tracker.getPosition();
   const double * position2D = tracker.getPosition2D();
-  const Quaternion& quaternionComp = tracker.getQuaternionComp();
   const Quaternion& quaternionHm = tracker.getQuaternionHm();
 
-  if (hmTrack > -2) {
+  uint32_t outputStart = getCycleCount();
+  uint64_t lighthouseTime = ticksToMicros(tracker.getPoseTimestamp());
+
+  if (lighthouseDue) {
     // base station data available
 
-    //print base station data
-    Serial.printf("BS ");
-    Serial.printf("%.3f %.3f %d\n", pitch, roll, mode);
+    //send base station data
+    telemetry.begin(TM_BS, lighthouseTime);
+    telemetry.addFloat(pitch);
+    telemetry.addFloat(roll);
+    telemetry.addInt(mode);
+    telemetry.end();
 
-    // print num sweep pulse detections for each axis of each photodiode
+    // send num sweep pulse detections for each axis of each photodiode
     // order is sensor0x, sensor0y, ... sensor3x, sensor3y
     // should normally be 1 1 1 1 1 1 1 1
     // could be more than 2 if there are inter-reflections,
     // or 0 if there are occlusions
-    Serial.printf("NP ");
+    telemetry.begin(TM_NP, lighthouseTime);
     for (int i = 0; i < 8; i++) {
-      Serial.printf("%lu ", numPulseDetections[i]);
+      telemetry.addUint(numPulseDetections[i]);
     }
-    Serial.println();
+    telemetry.end();
 
   }
 
-  if (hmTrack == 1 ) {
+  if (lighthouseDue && hmTrack == 1) {
+
+    //send time of the lighthouse data, in the same time base as the imu
+    telemetry.begin(TM_TL, lighthouseTime);
+    telemetry.end();
 
-    //print xyz position
-    Serial.printf("PS %.3f %.3f %.3f\n",
-      position[0], position[1], position[2]);
+    //the pose of the EKF is sent with the imu values
+    if (!tracker.isEkfValid()) {
 
-    //print quaternion from homography
-    Serial.printf("QH %.3f %.3f %.3f %.3f\n",
-      quaternionHm.q[0], quaternionHm.q[1],
-      quaternionHm.q[2], quaternionHm.q[3]);
+      //send xyz position, unless the position filter reports it
+      if (!tracker.isPositionFilterValid()) {
+        telemetry.begin(TM_PS, lighthouseTime);
+        telemetry.addPosition(position);
+        telemetry.end();
+      }
 
-    //print 2D positions of photodiodes for visualization
-    Serial.printf("PD ");
+      //send quaternion from homography
+      telemetry.begin(TM_QH, lighthouseTime);
+      telemetry.addQuaternion(quaternionHm);
+      telemetry.end();
+
+    }
+
+    //send 2D positions of photodiodes for visualization,
+    //nan for occluded diodes
+    telemetry.begin(TM_PD, lighthouseTime);
     for (int i = 0; i < 8; i++) {
-      Serial.printf("%.3f ", position2D[i]);
+      telemetry.addFloat(position2D[i]);
     }
-    Serial.println();
+    telemetry.end();
 
   }
 
-  if (imuTrack == 1) {
+  if (diagnosticsScheduler.due(now)) {
+
+    uint64_t time = ticksToMicros(InputCapture::now());
+
+    //send valid poses per second: without and with frames in which
+    //the selected pulse of an interreflection was used
+    telemetry.begin(TM_VP, time);
+    telemetry.addInt(tracker.getStrictPoseRate());
+    telemetry.addInt(tracker.getValidPoseRate());
+    telemetry.end();
+
+    //send sync lock status: locked, resyncs, missed and ignored syncs,
+    //and the measured rotor period of the primary station in ticks
+    const Lighthouse& lighthouse = tracker.getLighthouse();
+    telemetry.begin(TM_LS, time);
+    telemetry.addInt(lighthouse.isSyncLocked());
+    telemetry.addUint(lighthouse.getSyncResyncs());
+    telemetry.addUint(lighthouse.getSyncMissed());
+    telemetry.addUint(lighthouse.getSyncRejected());
+    telemetry.addFloat(tracker.getRotorPeriod(), 2);
+    telemetry.end();
+
+    //send average CPU cycles per imu sample of the orientation filter,
+    //the position filter and the EKF propagation, and per iteration of
+    //the messages sent
+    telemetry.begin(TM_CY, time);
+    telemetry.addUint(tracker.getOrientationCycles().average());
+    telemetry.addUint(tracker.getPositionFilterCycles().average());
+    telemetry.addUint(tracker.getEkfCycles().average());
+    telemetry.addUint(outputCycles.average());
+    telemetry.end();
+    tracker.resetCycleStats();
+    outputCycles.reset();
+
+    //send iterations of loop(), imu samples and lighthouse frames
+    //processed per second
+    double seconds = (now - prevDiagnosticsTime) / 1000000.0;
+    telemetry.begin(TM_LR, time);
+    telemetry.addUint((nLoops - prevLoops) / seconds);
+    telemetry.addUint((nImuUpdates - prevImuUpdates) / seconds);
+    telemetry.addUint((nLighthouseUpdates - prevLighthouseUpdates) / seconds);
+    telemetry.end();
+    prevLoops = nLoops;
+    prevImuUpdates = nImuUpdates;
+    prevLighthouseUpdates = nLighthouseUpdates;
+    prevDiagnosticsTime = now;
+
+    //send the imu temperature and the model of the gyro bias over it
+    const GyroBiasModel& gyrBiasModel = tracker.getGyrBiasModel();
+    telemetry.begin(TM_GYR_TEMP, time);
+    telemetry.addFloat(tracker.getImuTemperature(), 2);
+    telemetry.addFloat(gyrBiasModel.getTemperature(), 2);
+    for (int i = 0; i < 3; i++) {
+      telemetry.addFloat(gyrBiasModel.getBias()[i], 5);
+    }
+    for (int i = 0; i < 3; i++) {
+      telemetry.addFloat(gyrBiasModel.getSlope()[i], 5);
+    }
+    telemetry.addUint(gyrBiasModel.getUpdates());
+    telemetry.end();
 
-  //print quaternion from imu
-    Serial.printf("QC %.3f %.3f %.3f %.3f\n",
-      quaternionComp.q[0], quaternionComp.q[1],
-      quaternionComp.q[2], quaternionComp.q[3]);
+  }
+
+  if (imuTrack == 1 && imuPoseScheduler.due(now)) {
+
+    //send time of the imu sample. the poses below are predicted
+    //by predictionHorizon from it
+    uint64_t imuTime = ticksToMicros(tracker.getImuTimestamp());
+    telemetry.begin(TM_TI, imuTime);
+    telemetry.end();
+
+    //send quaternion from imu, predicted by the horizon.
+    //the predictions are only computed if they are subscribed
+    if (telemetry.isSubscribed(TM_QC)) {
+      Quaternion quaternionPredicted = tracker.predict(predictionHorizon);
+      telemetry.begin(TM_QC, imuTime);
+      telemetry.addQuaternion(quaternionPredicted);
+      telemetry.end();
+    }
+
+    Quaternion quaternionPose;
+    double positionPose[3];
+    if ((telemetry.isSubscribed(TM_PS) || telemetry.isSubscribed(TM_QH)) &&
+      tracker.predictPose(predictionHorizon, quaternionPose, positionPose)) {
+
+      //send pose from the EKF or position filter, in the same format as
+      //the lighthouse pose. without the EKF, the orientation is sent
+      //with the lighthouse pose
+      telemetry.begin(TM_PS, imuTime);
+      telemetry.addPosition(positionPose);
+      telemetry.end();
+
+      if (tracker.isEkfValid()) {
+        telemetry.begin(TM_QH, imuTime);
+        telemetry.addQuaternion(quaternionPose);
+        telemetry.end();
+      }
+
+    }
 
   }
 
-  delay(10);
+  if (hmTrack > -2 || imuTrack == 1) {
+    outputCycles.add(getCycleCount() - outputStart);
+  }
 
 }